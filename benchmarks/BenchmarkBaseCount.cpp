@@ -0,0 +1,61 @@
+#include "seqkernels.hpp"
+#include <x86intrin.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Microbenchmark for the base counting kernels in include/seqkernels.hpp.
+// Reports bytes per (TSC) cycle and GB/s for every ISA the CPU supports, on one large buffer
+// and on the same bytes split into short reads, which is how the parsers call the kernels.
+int main(int argc, char* argv[]) {
+  size_t bufLen = argc > 1 ? stoull(argv[1]) : (64ULL << 20);
+  size_t readLen = argc > 2 ? stoull(argv[2]) : 150;
+  int reps = argc > 3 ? stoi(argv[3]) : 10;
+
+  std::mt19937_64 rng(42);
+  const char alphabet[] = "ACGTACGTACGTACGTN";
+  std::string buf(bufLen, 'A');
+  for (auto& c : buf) {
+    c = alphabet[rng() % (sizeof(alphabet) - 1)];
+  }
+
+  BaseCounts reference;
+  seqkernels::count_bases_scalar(buf.data(), buf.size(), reference);
+
+  cout << "buffer " << bufLen << " bytes, read length " << readLen << ", " << reps << " repetitions\n";
+  cout << "isa\tlayout\tbytes/cycle\tGB/s\n";
+  for (auto isa : {seqkernels::Isa::Scalar, seqkernels::Isa::SSE42, seqkernels::Isa::AVX2, seqkernels::Isa::AVX512}) {
+    if (!seqkernels::isa_supported(isa)) {
+      cout << seqkernels::isa_name(isa) << "\tunsupported\n";
+      continue;
+    }
+    seqkernels::CountFn fn = seqkernels::count_fn(isa);
+    for (size_t chunk : {bufLen, readLen}) {
+      BaseCounts counts;
+      auto start = std::chrono::steady_clock::now();
+      uint64_t c0 = __rdtsc();
+      for (int r = 0; r < reps; ++r) {
+        for (size_t off = 0; off < bufLen; off += chunk) {
+          fn(buf.data() + off, std::min(chunk, bufLen - off), counts);
+        }
+      }
+      uint64_t cycles = __rdtsc() - c0;
+      auto end = std::chrono::steady_clock::now();
+      double secs = std::chrono::duration<double>(end - start).count();
+
+      if (counts.A != reference.A * reps || counts.C != reference.C * reps || counts.G != reference.G * reps ||
+          counts.T != reference.T * reps || counts.N != reference.N * reps) {
+        cerr << seqkernels::isa_name(isa) << ": counts do not match the scalar kernel\n";
+        return 1;
+      }
+      double bytes = static_cast<double>(bufLen) * reps;
+      cout << seqkernels::isa_name(isa) << '\t' << (chunk == bufLen ? "buffer" : "reads") << '\t'
+           << bytes / cycles << '\t' << bytes / secs / 1e9 << '\n';
+    }
+  }
+  cout << "dispatch picks " << seqkernels::isa_name(seqkernels::best_isa()) << '\n';
+  return 0;
+}
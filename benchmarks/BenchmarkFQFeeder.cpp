@@ -1,14 +1,11 @@
 #include "FastxParser.hpp"
+#include "seqkernels.hpp"
 #include <iostream>
 #include <thread>
 #include <vector>
 #include <chrono>
 using namespace std;
 
-struct Bases {
-  uint32_t A, C, G, T;
-};
-
 int main(int argc, char* argv[]) {
     auto start = std::chrono::high_resolution_clock::now();
 
@@ -26,7 +23,7 @@ int main(int argc, char* argv[]) {
   auto end_read = std::chrono::high_resolution_clock::now();
 
   std::vector<std::thread> readers;
-  std::vector<Bases> counters(nt, {0, 0, 0, 0});
+  std::vector<BaseCounts> counters(nt);
   std::atomic<size_t> ctr{0};
   for (size_t i = 0; i < nt; ++i) {
     readers.emplace_back([&, i]() {
@@ -44,45 +41,7 @@ int main(int argc, char* argv[]) {
 //            auto& seq = seqPair.first;
 //            auto& seq2 = seqPair.second;
 
-            size_t j = 0;
-            for (size_t j = 0; j < seq.seq.length(); ++j) {
-              char c = seq.seq[j];
-              switch (c) {
-              case 'A':
-                counters[i].A++;
-                break;
-              case 'C':
-                counters[i].C++;
-                break;
-              case 'G':
-                counters[i].G++;
-                break;
-              case 'T':
-                counters[i].T++;
-                break;
-              default:
-                break;
-              }
-            }
-            //for (size_t j = 0; j < seq2.seq.length(); ++j) {
-//              c = seq2.seq[j];
-//              switch (c) {
-//              case 'A':
-//                counters[i].A++;
-//                break;
-//              case 'C':
-//                counters[i].C++;
-//                break;
-//              case 'G':
-//                counters[i].G++;
-//                break;
-//              case 'T':
-//                counters[i].T++;
-//                break;
-//              default:
-//                break;
-//              }
-           // }
+            count_bases(seq.seq.data(), seq.seq.size(), counters[i]);
           }
           ctr += (lctr - pctr);
           pctr = lctr;
@@ -105,12 +64,9 @@ int main(int argc, char* argv[]) {
 
   parser.stop();
 
-  Bases b = {0, 0, 0, 0};
+  BaseCounts b;
   for (size_t i = 0; i < nt; ++i) {
-    b.A += counters[i].A;
-    b.C += counters[i].C;
-    b.G += counters[i].G;
-    b.T += counters[i].T;
+    b += counters[i];
   }
   std::cerr << "\n";
   std::cerr << "Parsed " << ctr << " total read pairs.\n";
@@ -118,6 +74,8 @@ int main(int argc, char* argv[]) {
   std::cerr << "#C = " << b.C << '\n';
   std::cerr << "#G = " << b.G << '\n';
   std::cerr << "#T = " << b.T << '\n';
+  std::cerr << "#N = " << b.N << '\n';
+  std::cerr << "GC = " << b.gcContent() << '\n';
     auto end = std::chrono::high_resolution_clock::now();
 
     // Calculate the duration in milliseconds
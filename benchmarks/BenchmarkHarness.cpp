@@ -0,0 +1,326 @@
+#include "zran.hpp"
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// One benchmark driver for all the parsing engines in this repository. Each configuration runs the
+// existing binary (countbases.out, fqfeeder.out, test_parser.out) as a child process, so every engine is
+// measured the same way: wall time, CPU utilization and peak RSS come from wait4(). Results are printed
+// as a table and optionally written as JSON/CSV; --baseline compares against a previous CSV.
+
+struct Config {
+  string engine;
+  size_t producers = 0;
+  size_t consumers = 0;
+  uint64_t chunk = 0;
+  uint64_t span = 0;
+
+  string key() const {
+    ostringstream os;
+    os << engine << ',' << producers << ',' << consumers << ',' << chunk << ',' << span;
+    return os.str();
+  }
+};
+
+struct Result {
+  Config config;
+  double wallMs = 0;
+  double cpuUtil = 0;
+  long peakRssKb = 0;
+  double mbPerSec = 0;
+  double recordsPerSec = 0;
+  bool ok = true;
+};
+
+struct Options {
+  string fastq;
+  string binDir = ".";
+  vector<string> engines = {"kseq", "fqfeeder", "parrfq"};
+  vector<size_t> producers = {1, 2, 4};
+  vector<size_t> consumers = {1, 2, 4};
+  vector<uint64_t> chunks = {10000};
+  vector<uint64_t> spans = {524288};
+  string mode = "records";
+  int reps = 3;
+  string json;
+  string csv;
+  string baseline;
+  double tolerance = 0.10;
+};
+
+template <typename T>
+vector<T> parseList(const string& s) {
+  vector<T> out;
+  stringstream ss(s);
+  string item;
+  while (getline(ss, item, ',')) {
+    stringstream is(item);
+    T v;
+    is >> v;
+    out.push_back(v);
+  }
+  return out;
+}
+
+void usage() {
+  cerr << "Usage: ./harness.out <fastq_file> [options]\n"
+       << "  --engines kseq,fqfeeder,parrfq   engines to run\n"
+       << "  --producers 1,2,4                producer/parsing thread counts\n"
+       << "  --consumers 1,2,4                consumer thread counts\n"
+       << "  --chunks 10000                   ParrFQParser records per claimed chunk\n"
+       << "  --spans 524288                   index spans (an index is built for each)\n"
+       << "  --mode records|packed|reduce     test_parser mode for parrfq\n"
+       << "  --reps 3                         repetitions per configuration, the median is reported\n"
+       << "  --bin-dir .                      directory holding the benchmark binaries\n"
+       << "  --json FILE --csv FILE           write results\n"
+       << "  --baseline FILE.csv              flag configurations slower than the baseline\n"
+       << "  --tolerance 0.10                 allowed slowdown before a regression is flagged\n";
+}
+
+// Runs argv with stdout/stderr discarded and returns the child's wall time and rusage
+bool runChild(const vector<string>& args, double& wallMs, struct rusage& usage) {
+  vector<char*> argv;
+  for (auto& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+  argv.push_back(nullptr);
+
+  auto start = std::chrono::steady_clock::now();
+  pid_t pid = fork();
+  if (pid == 0) {
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(devnull, STDERR_FILENO);
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+  int status = 0;
+  if (pid < 0 || wait4(pid, &status, 0, &usage) < 0) return false;
+  wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// indexFile is the index built for c.span, only used by the parrfq engine
+vector<string> commandFor(const Options& opt, const Config& c, const string& indexFile) {
+  if (c.engine == "kseq") return {opt.binDir + "/countbases.out", opt.fastq};
+  if (c.engine == "fqfeeder") {
+    return {opt.binDir + "/fqfeeder.out", opt.fastq, to_string(c.consumers), to_string(c.producers)};
+  }
+  return {opt.binDir + "/test_parser.out", opt.fastq, indexFile, to_string(c.consumers),
+          to_string(c.producers), opt.mode, to_string(c.chunk)};
+}
+
+Result measure(const Options& opt, const Config& c, const string& indexFile, double fileMb, uint64_t numRecords) {
+  Result r;
+  r.config = c;
+  // Every figure comes from the run with the median wall time, so they describe the same run
+  vector<Result> runs;
+  for (int i = 0; i < opt.reps; ++i) {
+    Result run = r;
+    struct rusage usage;
+    if (!runChild(commandFor(opt, c, indexFile), run.wallMs, usage)) {
+      r.ok = false;
+      return r;
+    }
+    double cpuMs = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+                   (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+    run.cpuUtil = cpuMs / run.wallMs;
+    run.peakRssKb = usage.ru_maxrss;
+    runs.push_back(run);
+  }
+  sort(runs.begin(), runs.end(), [](const Result& a, const Result& b) { return a.wallMs < b.wallMs; });
+  r = runs[runs.size() / 2];
+  r.mbPerSec = fileMb / (r.wallMs / 1e3);
+  r.recordsPerSec = numRecords / (r.wallMs / 1e3);
+  return r;
+}
+
+map<string, double> loadBaseline(const string& path) {
+  map<string, double> base;
+  ifstream in(path);
+  string line;
+  getline(in, line);  // header
+  while (getline(in, line)) {
+    // engine,producers,consumers,chunk,span,wall_ms,...
+    vector<string> cols = parseList<string>(line);
+    if (cols.size() < 6) continue;
+    if (cols.size() > 10 && cols[10] == "0") continue;  // a failed run has no wall time to compare with
+    base[cols[0] + ',' + cols[1] + ',' + cols[2] + ',' + cols[3] + ',' + cols[4]] = stod(cols[5]);
+  }
+  return base;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  Options opt;
+  opt.fastq = argv[1];
+  for (int i = 2; i + 1 < argc; i += 2) {
+    string flag = argv[i], value = argv[i + 1];
+    if (flag == "--engines") opt.engines = parseList<string>(value);
+    else if (flag == "--producers") opt.producers = parseList<size_t>(value);
+    else if (flag == "--consumers") opt.consumers = parseList<size_t>(value);
+    else if (flag == "--chunks") opt.chunks = parseList<uint64_t>(value);
+    else if (flag == "--spans") opt.spans = parseList<uint64_t>(value);
+    else if (flag == "--mode") opt.mode = value;
+    else if (flag == "--reps") opt.reps = stoi(value);
+    else if (flag == "--bin-dir") opt.binDir = value;
+    else if (flag == "--json") opt.json = value;
+    else if (flag == "--csv") opt.csv = value;
+    else if (flag == "--baseline") opt.baseline = value;
+    else if (flag == "--tolerance") opt.tolerance = stod(value);
+    else {
+      usage();
+      return 1;
+    }
+  }
+  if (opt.reps < 1) {
+    usage();
+    return 1;
+  }
+
+  struct stat st;
+  if (stat(opt.fastq.c_str(), &st) != 0) {
+    cerr << "Could not stat " << opt.fastq << "\n";
+    return 1;
+  }
+  double fileMb = st.st_size / 1e6;
+
+  // Expand the grid. Each engine only varies over the dimensions it has.
+  vector<Config> configs;
+  for (auto& engine : opt.engines) {
+    if (engine == "kseq") {
+      configs.push_back({engine});
+    } else if (engine == "fqfeeder") {
+      for (auto p : opt.producers)
+        for (auto c : opt.consumers) configs.push_back({engine, p, c});
+    } else if (engine == "parrfq") {
+      for (auto span : opt.spans)
+        for (auto chunk : opt.chunks)
+          for (auto p : opt.producers)
+            for (auto c : opt.consumers) configs.push_back({engine, p, c, chunk, span});
+    } else {
+      cerr << "Unknown engine " << engine << "\n";
+      return 1;
+    }
+  }
+  // Group the ParrFQParser runs by span so each index is built once
+  stable_sort(configs.begin(), configs.end(), [](const Config& a, const Config& b) { return a.span < b.span; });
+
+  // Each span's index is built next to the input under its own name, so the user's <fastq>.index.gzip is
+  // left alone, and removed once the runs that use it are done
+  vector<Result> results;
+  uint64_t builtSpan = 0;
+  uint64_t numRecords = 0;
+  string indexFile;
+  for (auto& c : configs) {
+    if (c.engine == "parrfq" && c.span != builtSpan) {
+      if (!indexFile.empty()) unlink(indexFile.c_str());
+      indexFile = opt.fastq + ".harness.span" + to_string(c.span) + ".index.gzip";
+      // build_index() reports on stdout; keep the table readable
+      auto t0 = std::chrono::steady_clock::now();
+      cout.setstate(std::ios::failbit);
+      bool built = true;
+      try {
+        build_index(opt.fastq.c_str(), c.span, false, indexFile.c_str());
+      } catch (const std::exception&) {
+        built = false;
+      }
+      cout.clear();
+      if (!built || access(indexFile.c_str(), R_OK) != 0) {
+        cerr << "Building the index with span " << c.span << " failed\n";
+        unlink(indexFile.c_str());
+        return 1;
+      }
+      builtSpan = c.span;
+      cerr << "built index with span " << c.span << " in "
+           << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() << " ms\n";
+    }
+    if (numRecords == 0 && builtSpan != 0) {
+      // The record count is stored in the index
+      struct deflate_index* index = NULL;
+      gzFile idx = gzopen(indexFile.c_str(), "rb");
+      if (idx != NULL && deflate_index_load_gzip(idx, &index) >= 0) {
+        numRecords = index->num_records;
+        deflate_index_free(index);
+      } else if (idx != NULL) {
+        gzclose(idx);
+      }
+    }
+    results.push_back(measure(opt, c, indexFile, fileMb, numRecords));
+    const Result& r = results.back();
+    cerr << c.key() << (r.ok ? "" : " FAILED") << " " << r.wallMs << " ms\n";
+  }
+  if (!indexFile.empty()) unlink(indexFile.c_str());
+  // Runs that happened before the record count was known. Failed runs have no wall time
+  for (auto& r : results) {
+    if (r.ok) r.recordsPerSec = numRecords / (r.wallMs / 1e3);
+  }
+
+  map<string, double> base;
+  if (!opt.baseline.empty()) base = loadBaseline(opt.baseline);
+  int regressions = 0;
+
+  cout << "engine\tproducers\tconsumers\tchunk\tspan\twall_ms\tMB/s\trecords/s\tcpu_util\tpeak_rss_kb\tvs_baseline\n";
+  for (auto& r : results) {
+    const Config& c = r.config;
+    string verdict = "";
+    auto it = base.find(c.key());
+    if (it != base.end() && r.ok) {
+      double ratio = r.wallMs / it->second;
+      ostringstream os;
+      os.precision(3);
+      os << ratio << "x";
+      if (ratio > 1 + opt.tolerance) {
+        os << " REGRESSION";
+        ++regressions;
+      }
+      verdict = os.str();
+    }
+    cout << c.engine << '\t' << c.producers << '\t' << c.consumers << '\t' << c.chunk << '\t' << c.span << '\t'
+         << (r.ok ? to_string(r.wallMs) : "failed") << '\t' << (r.ok ? to_string(r.mbPerSec) : "failed") << '\t'
+         << (r.ok ? to_string(r.recordsPerSec) : "failed") << '\t' << r.cpuUtil << '\t' << r.peakRssKb << '\t'
+         << verdict << '\n';
+  }
+
+  if (!opt.csv.empty()) {
+    ofstream out(opt.csv);
+    out << "engine,producers,consumers,chunk,span,wall_ms,mb_per_s,records_per_s,cpu_util,peak_rss_kb,ok\n";
+    for (auto& r : results) {
+      out << r.config.key() << ',' << r.wallMs << ',' << r.mbPerSec << ',' << r.recordsPerSec << ','
+          << r.cpuUtil << ',' << r.peakRssKb << ',' << r.ok << '\n';
+    }
+  }
+  if (!opt.json.empty()) {
+    ofstream out(opt.json);
+    out << "{\n  \"file\": \"" << opt.fastq << "\",\n  \"file_mb\": " << fileMb << ",\n  \"records\": " << numRecords
+        << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+      const Result& r = results[i];
+      out << "    {\"engine\": \"" << r.config.engine << "\", \"producers\": " << r.config.producers
+          << ", \"consumers\": " << r.config.consumers << ", \"chunk\": " << r.config.chunk
+          << ", \"span\": " << r.config.span << ", \"wall_ms\": " << r.wallMs << ", \"mb_per_s\": " << r.mbPerSec
+          << ", \"records_per_s\": " << r.recordsPerSec << ", \"cpu_util\": " << r.cpuUtil
+          << ", \"peak_rss_kb\": " << r.peakRssKb << ", \"ok\": " << (r.ok ? "true" : "false") << "}"
+          << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+  }
+
+  if (regressions > 0) {
+    cerr << regressions << " configuration(s) regressed by more than " << opt.tolerance * 100 << "%\n";
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,134 @@
+#include "zran.hpp"
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Random-access latency of read_index() as a function of the index span. For every span an index is
+// built next to the input (<file>.span<N>.index.gzip, removed afterwards), then single records and small
+// ranges are extracted at uniformly random and at skewed (Zipf-like) positions. The output is one row
+// per span and access pattern: index size on disk and in memory, build and load time, and latency
+// percentiles, which is the trade-off to look at when picking the span for `main.out build`.
+// Latencies are measured with the input in the page cache.
+
+struct Latency {
+  double p50, p95, p99, max, meanDiscardKb;
+};
+
+// In-memory footprint of a loaded index: access points, their windows and the record offsets
+uint64_t indexMemory(const struct deflate_index* index) {
+  uint64_t bytes = static_cast<uint64_t>(index->have) * sizeof(point_t);
+  for (int i = 0; i < index->have; ++i) {
+    if (index->list[i].window != NULL) bytes += index->list[i].dict;
+  }
+  if (index->record_boundaries != NULL) bytes += index->record_boundaries->size() * sizeof(uint64_t);
+  return bytes;
+}
+
+Latency measure(const char* file, struct deflate_index* index, const vector<off_t>& starts, off_t range) {
+  vector<double> us;
+  uint64_t discarded = 0;
+  for (off_t start : starts) {
+    extract_stats_t extracted;
+    auto t0 = std::chrono::steady_clock::now();
+    unsigned char* buf;
+    int got;
+    std::tie(buf, got) = read_index(file, index, start, range, NULL, &extracted);
+    auto t1 = std::chrono::steady_clock::now();
+    free(buf);
+    if (got < 0) {
+      cerr << "Extraction failed at record " << start << "\n";
+      exit(1);
+    }
+    us.push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+    discarded += extracted.bytes_discarded;
+  }
+  sort(us.begin(), us.end());
+  auto pct = [&](double p) { return us[min(us.size() - 1, static_cast<size_t>(p * us.size()))]; };
+  return {pct(0.50), pct(0.95), pct(0.99), us.back(), discarded / 1024.0 / starts.size()};
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: ./random_access_bench.out <fastq_file> [spans=131072,524288,2097152,8388608] [queries=1000]"
+         << " [range=100] [seed=42]\n";
+    return 1;
+  }
+  const char* file = argv[1];
+  vector<off_t> spans = {131072, 524288, 2097152, 8388608};
+  if (argc > 2) {
+    spans.clear();
+    stringstream ss(argv[2]);
+    string item;
+    while (getline(ss, item, ',')) spans.push_back(stoll(item));
+  }
+  size_t queries = argc > 3 ? stoull(argv[3]) : 1000;
+  off_t range = argc > 4 ? stoll(argv[4]) : 100;
+  uint64_t seed = argc > 5 ? stoull(argv[5]) : 42;
+
+  cout << "span\tpoints\tindex_file_KB\tindex_mem_KB\tbuild_ms\tload_ms\tpattern\trecords\tp50_us\tp95_us\tp99_us"
+       << "\tmax_us\tdiscarded_KB\n";
+  for (off_t span : spans) {
+    string indexFile = string(file) + ".span" + to_string(span) + ".index.gzip";
+
+    // build_index() and the loader report on stdout; keep the table readable
+    auto t0 = std::chrono::steady_clock::now();
+    cout.setstate(std::ios::failbit);
+    build_index(file, span, false, indexFile.c_str());
+    auto t1 = std::chrono::steady_clock::now();
+    struct deflate_index* index = NULL;
+    gzFile idx = gzopen(indexFile.c_str(), "rb");
+    int have = idx != NULL ? deflate_index_load_gzip(idx, &index) : -1;
+    auto t2 = std::chrono::steady_clock::now();
+    cout.clear();
+    if (have < 0) {
+      cerr << "Could not load " << indexFile << "\n";
+      return 1;
+    }
+    struct stat st;
+    stat(indexFile.c_str(), &st);
+    remove(indexFile.c_str());
+
+    // The same query positions for every span
+    std::mt19937_64 rng(seed);
+    off_t numRecords = index->num_records;
+    std::uniform_int_distribution<off_t> uniform(0, numRecords - 1);
+    vector<off_t> uniformStarts(queries);
+    for (auto& s : uniformStarts) s = uniform(rng);
+
+    // Skewed: 1024 regions of the file, region of rank r picked with probability ~ 1/(r+1)
+    const int REGIONS = 1024;
+    vector<double> weights(REGIONS);
+    for (int r = 0; r < REGIONS; ++r) weights[r] = 1.0 / (r + 1);
+    vector<int> regionOf(REGIONS);
+    std::iota(regionOf.begin(), regionOf.end(), 0);
+    std::shuffle(regionOf.begin(), regionOf.end(), rng);
+    std::discrete_distribution<int> rank(weights.begin(), weights.end());
+    vector<off_t> skewedStarts(queries);
+    for (auto& s : skewedStarts) {
+      off_t regionLen = max<off_t>(1, numRecords / REGIONS);
+      off_t first = min<off_t>(numRecords - 1, regionOf[rank(rng)] * regionLen);
+      s = min<off_t>(numRecords - 1, first + static_cast<off_t>(rng() % regionLen));
+    }
+
+    double buildMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    double loadMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    for (auto pattern : {"uniform", "skewed"}) {
+      const vector<off_t>& starts = string(pattern) == "uniform" ? uniformStarts : skewedStarts;
+      for (off_t n : {static_cast<off_t>(1), range}) {
+        Latency l = measure(file, index, starts, n);
+        cout << span << '\t' << index->have << '\t' << st.st_size / 1024 << '\t' << indexMemory(index) / 1024 << '\t'
+             << buildMs << '\t' << loadMs << '\t' << pattern << '\t' << n << '\t' << l.p50 << '\t' << l.p95 << '\t'
+             << l.p99 << '\t' << l.max << '\t' << l.meanDiscardKb << '\n';
+      }
+    }
+    deflate_index_free(index);
+  }
+  return 0;
+}
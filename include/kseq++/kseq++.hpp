@@ -73,6 +73,11 @@ namespace klibpp {
     enum Format { mix, fasta, fastq };
   }
 
+  namespace field {
+    /* Fields of a KSeq that operator>> fills in; the others are skipped without being copied */
+    enum Field : unsigned { name = 1, comment = 2, seq = 4, qual = 8, all = 15 };
+  }
+
   struct KEnd_ {};
   constexpr KEnd_ kend;
 
@@ -106,6 +111,7 @@ namespace klibpp {
         size_type w_end;                                /**< @brief end second buffer index or error flag if -1 */
         unsigned int wraplen;                           /**< @brief line wrap length */
         unsigned long int counter;                      /**< @brief number of records written so far */
+        unsigned long long int bytes_so_far;            /**< @brief bytes handed to the writer so far */
         format::Format fmt;                             /**< @brief format of the output records */
         TFile f;                                        /**< @brief file handler */
         TFunc func;                                     /**< @brief write function */
@@ -129,6 +135,7 @@ namespace klibpp {
           this->produced = false;
           this->w_end = 0;
           this->counter = 0;
+          this->bytes_so_far = 0;
           this->worker_start();
         }
 
@@ -203,6 +210,7 @@ namespace klibpp {
           this->w_end = other.w_end;
           this->wraplen = other.wraplen;
           this->counter = other.counter;
+          this->bytes_so_far = other.bytes_so_far;
           this->fmt = other.fmt;
           this->f = std::move( other.f );
           this->func = std::move( other.func );
@@ -230,6 +238,7 @@ namespace klibpp {
           this->w_end = other.w_end;
           this->wraplen = other.wraplen;
           this->counter = other.counter;
+          this->bytes_so_far = other.bytes_so_far;
           this->fmt = other.fmt;
           this->f = std::move( other.f );
           this->func = std::move( other.func );
@@ -238,7 +247,7 @@ namespace klibpp {
           return *this;
         }
 
-        ~KStream( ) noexcept
+        virtual ~KStream( ) noexcept
         {
           this->worker_join();
           delete[] this->m_buf;
@@ -257,6 +266,13 @@ namespace klibpp {
         {
           return this->fmt;
         }
+
+          inline unsigned long long int
+        tellp( ) const
+        {
+          // uncompressed offset at which the next character will be written
+          return this->bytes_so_far + this->m_begin;
+        }
         /* Mutators */
           inline void
         set_wraplen( unsigned int len )
@@ -291,6 +307,7 @@ namespace klibpp {
           inline KStream&
         operator<<( const KSeq& rec )
         {
+          this->on_record( this->tellp() );
           if ( ( this->fmt == format::mix && rec.qual.empty() ) ||  // FASTA record
                ( this->fmt == format::fasta ) ) this->puts( '>' );      // Forced FASTA
           else {
@@ -382,6 +399,11 @@ namespace klibpp {
             this->cv->wait( lock, [this]{ return !this->produced; } );
           }
         }
+      protected:
+        /* Hooks */
+        /**< @brief called by operator<< with tellp() right before each record is written */
+          virtual void
+        on_record( unsigned long long int ) { }
       private:
         /* Methods */
           inline void
@@ -395,6 +417,7 @@ namespace klibpp {
             this->m_end = this->w_end;
             if ( !this->fail() ) {
               this->w_end = this->m_begin;
+              this->bytes_so_far += this->m_begin;
               std::copy( this->m_buf, this->m_buf + this->m_begin, this->w_buf );
               this->produced = true;
               if ( term ) this->terminate = true;  /**< XXX: only set here! */
@@ -465,6 +488,7 @@ namespace klibpp {
         bool last;                           /**< @brief last read was successful */
         unsigned long int counter;           /**< @brief number of parsed records so far */
         unsigned long long int bytes_so_far;
+        unsigned fields;                     /**< @brief field::Field mask of the members to fill */
         TFile f;                             /**< @brief file handler */
         TFunc func;                          /**< @brief read function */
         close_type close;                    /**< @brief close function */
@@ -485,6 +509,7 @@ namespace klibpp {
           this->last = false;
           this->counter = 0;
           this->bytes_so_far= -1 * DEFAULT_BUFSIZE;
+          this->fields = field::all;
         }
 
         KStream( TFile f_,
@@ -526,6 +551,7 @@ namespace klibpp {
           this->func = std::move( other.func );
           this->close = other.close;
           this->bytes_so_far= -1 * DEFAULT_BUFSIZE;
+          this->fields = other.fields;
         }
 
         KStream& operator=( KStream&& other ) noexcept
@@ -545,6 +571,7 @@ namespace klibpp {
           this->f = std::move( other.f );
           this->func = std::move( other.func );
           this->close = other.close;
+          this->fields = other.fields;
           return *this;
         }
 
@@ -558,8 +585,25 @@ namespace klibpp {
         counts( ) const
         {
           return this->counter;
+        }
+          inline unsigned
+        get_fields( ) const
+        {
+          return this->fields;
         }
         /* Methods */
+        /**
+         *  @brief Restrict operator>> to the given field::Field mask. Fields left out stay
+         *  empty: their bytes are skipped line by line with memchr instead of being copied.
+         *  Records are still split the same way, since the length of a skipped sequence is
+         *  counted to know how many quality lines follow.
+         */
+          inline void
+        set_fields( unsigned fields_ )
+        {
+          this->fields = fields_;
+        }
+
           inline bool
         err( ) const  // ks_err
         {
@@ -596,6 +640,61 @@ namespace klibpp {
           }  // else: the first header char has been read in the previous call
           rec.bytes_offset = this->bytes_so_far + this->begin - 1;
           rec.clear();  // reset all members
+          if ( this->fields == field::all ) return this->read_all( rec );
+          if ( !( this->fields & field::name ? this->getuntil( KStream::SEP_SPACE, rec.name, &c )
+                                               : this->skipuntil( KStream::SEP_SPACE, &c ) ) ) {
+            return *this;
+          }
+          if ( c != '\n' ) {  // read FASTA/Q comment
+            if ( this->fields & field::comment ) this->getuntil( KStream::SEP_LINE, rec.comment, nullptr );
+            else this->skipuntil( KStream::SEP_LINE, nullptr );
+          }
+          size_type seqlen = 0;
+          while ( ( c = this->getc( ) ) && c != '>' && c != '@' && c != '+' ) {
+            if ( c == '\n' ) continue;  // skip empty lines
+            if ( this->fields & field::seq ) {
+              rec.seq += c;
+              this->getuntil( KStream::SEP_LINE, rec.seq, nullptr, true ); // read the rest of the line
+            }
+            else {
+              size_type len;
+              this->skipuntil( KStream::SEP_LINE, nullptr, &len, c );
+              seqlen += len;
+            }
+          }
+          if ( this->fields & field::seq ) seqlen = rec.seq.size();
+          this->last = true;
+          ++this->counter;
+          if ( c == '>' || c == '@' ) this->is_ready = true;  // the first header char has been read
+          if ( c != '+' ) return *this;  // FASTA
+          while ( ( c = this->getc( ) ) && c != '\n' );  // skip the rest of '+' line
+          if ( this->eof() ) {  // error: no quality string
+            this->is_tqs = true;
+            return *this;
+          }
+          size_type quallen = 0;
+          if ( this->fields & field::qual ) {
+            while ( this->getuntil( KStream::SEP_LINE, rec.qual, nullptr, true ) &&
+                rec.qual.size() < static_cast< size_t >( seqlen ) );
+            quallen = rec.qual.size();
+          }
+          else {
+            size_type len;
+            while ( this->skipuntil( KStream::SEP_LINE, nullptr, &len ) && ( quallen += len ) < seqlen );
+          }
+          if ( this->err() ) return *this;
+          this->is_ready = false;  // we have not come to the next header line
+          if ( seqlen != quallen ) {  // error: qual string is of a different length
+            this->is_tqs = true;
+          }
+          return *this;
+        }
+
+        /* operator>> with every field, the common case, kept free of per-line field checks */
+          inline KStream&
+        read_all( KSeq& rec )
+        {
+          char_type c;
           if ( !this->getuntil( KStream::SEP_SPACE, rec.name, &c ) ) return *this;
           if ( c != '\n' ) {  // read FASTA/Q comment
             this->getuntil( KStream::SEP_LINE, rec.comment, nullptr );
@@ -728,6 +827,59 @@ namespace klibpp {
           }
           return true;
         }
+
+        /**
+         *  @brief Same as getuntil() without storing anything: sets *len to the number of
+         *  characters getuntil() would have appended. first is a character of the same token
+         *  that the caller already consumed (0 if none); it is included in *len.
+         */
+          inline bool
+        skipuntil( char_type delimiter, char_type *dret, size_type *len=nullptr, char_type first=0 )
+          noexcept
+        {
+          char_type c;
+          bool gotany = false;
+          size_type n = first ? 1 : 0;
+          char_type lastc = first;
+          if ( dret ) *dret = 0;
+          size_type i = -1;
+          do {
+            if ( !( c = this->getc( ) ) ) break;
+            --this->begin;
+            if ( delimiter == KStream::SEP_LINE ) {
+              char_type* sep = ( char_type* )std::memchr( this->buf + this->begin, '\n', this->end - this->begin );
+              i = ( sep != nullptr ) ? ( sep - this->buf ) : this->end;
+            }
+            else if ( delimiter > KStream::SEP_MAX ) {
+              for ( i = this->begin; i < this->end; ++i ) {
+                if ( this->buf[ i ] == delimiter ) break;
+              }
+            }
+            else if ( delimiter == KStream::SEP_SPACE ) {
+              for ( i = this->begin; i < this->end; ++i ) {
+                if ( std::isspace( this->buf[ i ] ) ) break;
+              }
+            }
+            else {
+              for ( i = this->begin; i < this->end; ++i ) {
+                if ( std::isspace( this->buf[ i ] ) && this->buf[ i ] != ' ' ) break;
+              }
+            }
+
+            gotany = true;
+            if ( i > this->begin ) lastc = this->buf[ i - 1 ];
+            n += i - this->begin;
+            this->begin = i + 1;
+          } while ( i >= this->end );
+
+          // Set even on failure: like the string getuntil() leaves, *len still counts first at end of file
+          if ( delimiter == KStream::SEP_LINE && n > 0 && lastc == '\r' ) --n;
+          if ( len ) *len = n;
+          if ( this->err() || ( this->eof() && !gotany ) ) return false;
+
+          if ( !this->eof() && dret ) *dret = this->buf[ i ];
+          return true;
+        }
     };
 
   template< typename TFile, typename TFunc >
@@ -0,0 +1,153 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "kseq++/kseq++.hpp"
+#include "recordview.hpp"
+
+// Run of consecutive identical non-ACGT characters (N or any IUPAC code) in a sequence.
+// The packed words hold code 0 (A) at these positions, so consumers must consult the runs
+// before trusting a base.
+struct NRun {
+  uint32_t pos;
+  uint32_t len;
+  char base;
+};
+
+// Sequence stored as 2 bits per base (A=0, C=1, G=2, T=3), 32 bases per 64-bit word with
+// the first base in the lowest bits. Lower case acgt are folded to upper case.
+struct PackedSeq {
+  std::string name;
+  std::string comment;
+  std::string qual;                     // only filled when the parser keeps qualities
+  std::vector<uint64_t> words;
+  std::vector<NRun> exceptions;
+  uint32_t length = 0;                  // number of bases
+  unsigned long long int bytes_offset = 0;  // bytes offset from start of the file where this record starts
+
+  inline void clear() {
+    name.clear();
+    comment.clear();
+    qual.clear();
+    words.clear();
+    exceptions.clear();
+    length = 0;
+    bytes_offset = 0;
+  }
+
+  inline uint8_t code_at(size_t i) const {
+    return (words[i >> 5] >> ((i & 31) << 1)) & 3;
+  }
+};
+
+namespace packed {
+  constexpr uint8_t EXCEPTION = 4;
+
+  struct CodeTable {
+    uint8_t code[256];
+    constexpr CodeTable() : code() {
+      for (int i = 0; i < 256; ++i) code[i] = EXCEPTION;
+      code['A'] = code['a'] = 0;
+      code['C'] = code['c'] = 1;
+      code['G'] = code['g'] = 2;
+      code['T'] = code['t'] = 3;
+    }
+  };
+
+  constexpr CodeTable TABLE;
+  constexpr char BASES[4] = {'A', 'C', 'G', 'T'};
+}
+
+// Packs seq into out.words / out.exceptions. Reuses the capacity already held by out.
+inline void pack_seq(const char* seq, size_t len, PackedSeq& out) {
+  out.length = static_cast<uint32_t>(len);
+  out.words.assign((len + 31) >> 5, 0);
+  out.exceptions.clear();
+
+  for (size_t w = 0; w < out.words.size(); ++w) {
+    size_t begin = w << 5;
+    size_t end = begin + 32 < len ? begin + 32 : len;
+    uint64_t word = 0;
+    for (size_t i = begin; i < end; ++i) {
+      char c = seq[i];
+      uint8_t code = packed::TABLE.code[static_cast<unsigned char>(c)];
+      if (code == packed::EXCEPTION) {
+        NRun* last = out.exceptions.empty() ? nullptr : &out.exceptions.back();
+        if (last != nullptr && last->base == c && last->pos + last->len == i) {
+          ++last->len;
+        } else {
+          out.exceptions.push_back({static_cast<uint32_t>(i), 1, c});
+        }
+        code = 0;
+      }
+      word |= static_cast<uint64_t>(code) << ((i - begin) << 1);
+    }
+    out.words[w] = word;
+  }
+}
+
+inline void pack_record(const klibpp::KSeq& rec, PackedSeq& out, bool keepQual) {
+  out.name = rec.name;
+  out.comment = rec.comment;
+  if (keepQual) {
+    out.qual = rec.qual;
+  } else {
+    out.qual.clear();
+  }
+  out.bytes_offset = rec.bytes_offset;
+  pack_seq(rec.seq.data(), rec.seq.size(), out);
+}
+
+// Packs a record straight from the extracted buffer, copying only the name, comment and quality fields in
+// the klibpp::field mask (the sequence is always packed).
+inline void pack_record(const RecordView& rec, PackedSeq& out, unsigned fields, bool keepQual) {
+  if (fields & klibpp::field::name) {
+    out.name.assign(rec.name.data(), rec.name.size());
+  } else {
+    out.name.clear();
+  }
+  if (fields & klibpp::field::comment) {
+    out.comment.assign(rec.comment.data(), rec.comment.size());
+  } else {
+    out.comment.clear();
+  }
+  if (keepQual && (fields & klibpp::field::qual)) {
+    out.qual.assign(rec.qual.data(), rec.qual.size());
+  } else {
+    out.qual.clear();
+  }
+  out.bytes_offset = rec.bytes_offset;
+  pack_seq(rec.seq.data(), rec.seq.size(), out);
+}
+
+// Restores the sequence with acgt in upper case; the N/IUPAC runs keep their case (e.g. 'n').
+inline std::string unpack_seq(const PackedSeq& p) {
+  std::string seq(p.length, 'A');
+  for (size_t i = 0; i < p.length; ++i) {
+    seq[i] = packed::BASES[p.code_at(i)];
+  }
+  for (const NRun& run : p.exceptions) {
+    seq.replace(run.pos, run.len, run.len, run.base);
+  }
+  return seq;
+}
+
+// Counts A/C/G/T straight from the packed words, excluding positions covered by exceptions. Lower case acgt
+// were folded when packing, which matches count_bases().
+inline void packed_base_counts(const PackedSeq& p, uint64_t counts[4]) {
+  const uint64_t LOW = 0x5555555555555555ULL;
+  for (size_t w = 0; w < p.words.size(); ++w) {
+    size_t valid = p.length - (w << 5);
+    uint64_t mask = valid >= 32 ? LOW : LOW & ((1ULL << (valid << 1)) - 1);
+    uint64_t lo = p.words[w] & LOW;
+    uint64_t hi = (p.words[w] >> 1) & LOW;
+    counts[0] += __builtin_popcountll(~hi & ~lo & mask);
+    counts[1] += __builtin_popcountll(~hi & lo & mask);
+    counts[2] += __builtin_popcountll(hi & ~lo & mask);
+    counts[3] += __builtin_popcountll(hi & lo & mask);
+  }
+  for (const NRun& run : p.exceptions) {
+    counts[0] -= run.len;
+  }
+}
@@ -2,13 +2,27 @@
 #include "zran.hpp"
 #include "kseq++/seqio.hpp"
 #include "kseqcharstream.hpp"
+#include "packedseq.hpp"
+#include "recordview.hpp"
+#include "recordchunk.hpp"
+#include "recordbatch.hpp"
+#include "recordfilter.hpp"
+#include "parserstats.hpp"
+#include "tracer.hpp"
 #include "concurrentqueue/concurrentqueue.h"
+#include "concurrentqueue/blockingconcurrentqueue.h"
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <atomic>
 #include <thread>
 #include <vector>
 #include <memory>
+#include <mutex>
 #include <functional>
+#include <algorithm>
+#include <cmath>
+#include <new>
 
 class ParrFQParser {
  public:
@@ -18,23 +32,149 @@ class ParrFQParser {
 
   int init(const std::string& fastqFilename, const std::string& indexFileName, uint64_t perThreadReads, uint64_t numThreads);
 
+  // Emit 2-bit packed sequences instead of KSeq records. Must be called before start()
+  void setPackedOutput(bool packed, bool keepQual = false);
+
+  // Hand out whole chunks (RecordChunk) whose records point into the chunk's decompressed buffer, so the
+  // producers never allocate per record. At most maxChunks chunks exist (default 2 per producer); a producer
+  // waits for a consumer to release one when all are in use. Must be called before start()
+  void setChunkOutput(bool chunks, size_t maxChunks = 0);
+
+  // Hand out columnar RecordBatches, one per chunk, filled by the producers straight from the extracted
+  // buffer. Pooled like setChunkOutput(); must be called before start()
+  void setBatchOutput(bool batches, size_t maxBatches = 0);
+
+  // Only fill in the record fields in the klibpp::field mask (default all); the others are left empty and
+  // skipped by the parser without being copied. Packed output always keeps the sequence. Applies to KSeq
+  // records and RecordBatch columns; chunk output never copies fields anyway. Must be called before start()
+  void setFields(unsigned fields);
+
+  // Split the producers into two stages: inflater threads extract chunks into raw buffers, and parser threads
+  // turn those into records and enqueue them. Without it every producer does both, one chunk after the other.
+  // A count of 0 is sized by start(): it inflates and parses the first chunk itself, and splits the
+  // numThreads given to init() (at least one per stage) in proportion to the measured extract and parse
+  // times; with one count given, the other stage gets the rest. Raw buffers come from a pool of
+  // inflaters + 2 * parsers (chunk output uses the chunk pool). Producer stats list the inflaters first.
+  // Does not apply to mapReduce(). Must be called before start()
+  void setPipeline(bool pipeline, uint64_t inflaters = 0, uint64_t parsers = 0);
+  // Thread counts of the two stages, known once start() returned
+  uint64_t inflaterThreads() const { return m_inflaters; }
+  uint64_t parserThreads() const { return m_parsers; }
+
   // Main function that will be called by each thread to parse the reads
   int parse_reads(uint64_t threadId, moodycamel::ProducerToken* token, uint64_t maxBufLen);
+  // Pipeline stages (setPipeline())
+  int inflate_chunks(uint64_t threadId);
+  int parse_chunks(uint64_t threadId, moodycamel::ProducerToken* token);
+
+  // Ask the kernel to read ahead the compressed bytes of upcoming chunks while the current one is
+  // inflated (posix_fadvise WILLNEED). On by default; must be set before start() or mapReduce().
+  void setPrefetch(bool prefetch);
+
+  // Map the compressed file into memory once and let every producer inflate straight from the mapping
+  // instead of reading it through its own FILE. Off by default; must be set before start() or mapReduce().
+  void setMmapInput(bool mmapInput);
+
+  // Record a timeline of every producer and consumer. Must be called before start() or mapReduce(), and
+  // before the consumers are created with getConsumer()
+  void enableTracing();
+  // Writes the recorded timeline as Chrome trace-event JSON. Call after stop() or mapReduce() returned.
+  int writeTrace(const std::string& path);
+
+  // Drop records in the producers, before they are enqueued. Filters run in the order they were added, and a
+  // record is kept only if every predicate returns true (see RecordFilters; recordfilter:: has common ones).
+  // Predicates only see the fields requested with setFields(). Pass/reject counts per filter are reported
+  // by stats(). Applies to every queued output mode, not to mapReduce(). Must be called before start()
+  void addFilter(const std::string& name, RecordPredicate keep);
 
   // Start and stop the parser
   int start();
   int stop();
 
+  // Fused decompress-and-reduce. Runs kernel(buf, len, partial) in each of the numThreads producer threads
+  // directly on every freshly extracted chunk (whole records, writable), then folds the per-thread partials
+  // into result with merge(result, partial). Nothing is enqueued; blocks until the whole file is reduced.
+  // Cannot be used while the parser is running.
+  template <typename T, typename Kernel, typename Merge>
+  int mapReduce(Kernel kernel, Merge merge, T& result);
+
+  // Same as mapReduce(), with kernel(buf, len, startRecordIdx, partial) also told the index of the chunk's
+  // first record; see recordBoundaries() to locate the others
+  template <typename T, typename Kernel, typename Merge>
+  int mapReduceChunks(Kernel kernel, Merge merge, T& result);
+
+  // Same as mapReduce(), with kernel(const RecordView&, partial) called once per record
+  template <typename T, typename Kernel, typename Merge>
+  int mapReduceRecords(Kernel kernel, Merge merge, T& result);
+
+  // Uncompressed start offset of every record, plus an end sentinel that may overshoot the data. Valid once
+  // start() or a mapReduce*() call has loaded the index
+  const std::vector<uint64_t>& recordBoundaries() const { return *m_index->record_boundaries; }
+  // Uncompressed length of the whole file, same precondition
+  uint64_t uncompressedLength() const { return m_index->length; }
+
+  // Consumer handle that also records ConsumerStats. Use one per consumer thread.
+  class Consumer {
+   public:
+    bool getRead(klibpp::KSeq& rec);
+    bool getPackedRead(PackedSeq& rec);
+    // Dequeues up to max records at once; batch is resized to the number returned
+    size_t getReads(std::vector<klibpp::KSeq>& batch, size_t max);
+    // Next chunk, for parsers started with setChunkOutput(true). The chunk goes back to the parser's pool
+    // when the handle is reset or destroyed, which must happen before the parser is destroyed
+    bool getChunk(RecordChunkPtr& chunk);
+    // Same for parsers started with setBatchOutput(true)
+    bool getBatch(RecordBatchPtr& batch);
+    // checkFinished(), and closes the final idle period once it returns true
+    bool finished();
+    // True if a record is waiting or the parser has finished, without dequeuing anything
+    bool ready();
+
+   private:
+    friend class ParrFQParser;
+    Consumer(ParrFQParser* parser, parserstats::ConsumerCounters* counters);
+    template <typename Queue, typename Rec>
+    bool dequeue(Queue& queue, moodycamel::ConsumerToken& token, Rec& rec);
+    void account(size_t n, uint64_t t0, uint64_t t1);
+
+    ParrFQParser* m_parser;
+    parserstats::ConsumerCounters* m_counters;
+    Tracer::ThreadBuffer* m_trace = nullptr;
+    uint64_t m_busySince = 0;  // 0 while the last poll found the queue empty
+    moodycamel::ConsumerToken m_token;
+    moodycamel::ConsumerToken m_packedToken;
+    moodycamel::ConsumerToken m_chunkToken;
+    moodycamel::ConsumerToken m_batchToken;
+    uint64_t m_idleSince = 0;  // 0 while the last poll found a record
+  };
+
   // Consumer functions
+  Consumer getConsumer();
   moodycamel::ConsumerToken getConsumerToken();
   bool getRead(moodycamel::ConsumerToken& token, klibpp::KSeq& rec);
+  moodycamel::ConsumerToken getPackedConsumerToken();
+  bool getPackedRead(moodycamel::ConsumerToken& token, PackedSeq& rec);
   bool checkFinished();
 
+  // Calls wake() once, from a producer thread, after the next chunk is enqueued or when the last producer
+  // exits. Lets a consumer sleep or suspend on an empty queue instead of spinning (see parsercoro.hpp).
+  // The caller must issue a seq_cst fence and check the queue again after registering, or it may sleep
+  // through the last wake-up.
+  void addWaiter(std::function<void()> wake);
+
+  // Snapshot of the producer and consumer counters; safe to call while the parser is running
+  ParserStats stats();
+
  private:
   // Each parser thread will check and update the current offset to claim a chunk of reads
   std::atomic<uint64_t> m_currMaxOffset;
   std::vector<std::unique_ptr<std::thread>> m_workers;
   std::unique_ptr<moodycamel::ConcurrentQueue<klibpp::KSeq>> m_readQueue;
+  std::unique_ptr<moodycamel::ConcurrentQueue<PackedSeq>> m_packedQueue;
+  std::unique_ptr<moodycamel::ConcurrentQueue<RecordChunk*>> m_chunkQueue;
+  std::unique_ptr<RecordChunkPool> m_chunkPool;
+  std::unique_ptr<moodycamel::ConcurrentQueue<RecordBatch*>> m_batchQueue;
+  std::unique_ptr<RecordBatchPool> m_batchPool;
   std::vector<std::unique_ptr<moodycamel::ProducerToken>> m_producerTokens;
   std::unique_ptr<struct deflate_index, std::function<void(struct deflate_index*)>> m_index;
 
@@ -43,11 +183,72 @@ class ParrFQParser {
   std::string m_fastqFilename;
   std::string m_indexFileName;
   bool m_isRunning = false;
+  bool m_packedOutput = false;
+  bool m_keepQual = false;
+  bool m_chunkOutput = false;
+  size_t m_maxChunks = 0;
+  bool m_batchOutput = false;
+  size_t m_maxBatches = 0;
+  unsigned m_fields = klibpp::field::all;
+  RecordFilters m_filters;
+  bool m_prefetch = true;
+  bool m_mmapInput = false;
+  gz_mapping_t m_mapping = {NULL, 0};
   std::atomic<uint32_t> m_numActiveThreads = 0;
+  bool m_pipeline = false;
+  uint64_t m_inflaters = 0;
+  uint64_t m_parsers = 0;
+  std::unique_ptr<moodycamel::BlockingConcurrentQueue<RecordChunk*>> m_rawQueue;
+  std::unique_ptr<RecordChunkPool> m_rawPool;  // raw buffers between the stages, unless chunks are the output
+  std::atomic<uint32_t> m_activeInflaters = 0;
+
+  // Runtime statistics
+  std::vector<std::unique_ptr<parserstats::ProducerCounters>> m_producerStats;
+  std::vector<std::unique_ptr<parserstats::ConsumerCounters>> m_consumerStats;
+  std::mutex m_consumerStatsMutex;
+  std::atomic<uint64_t> m_queueHighWaterMark{0};
+  std::unique_ptr<Tracer> m_tracer;
+  std::mutex m_waitersMutex;
+  std::vector<std::function<void()>> m_waiters;
+  std::atomic<bool> m_hasWaiters{false};
+
+  // Per-thread state of the parse-and-enqueue step. The record vectors keep their slots across chunks, but
+  // enqueue_bulk() moves the strings out of them, so each chunk's records allocate their fields again
+  struct ParseState {
+    moodycamel::ProducerToken* token;  // for m_readQueue
+    std::unique_ptr<moodycamel::ProducerToken> outputToken;  // for the packed, chunk or batch queue
+    std::vector<klibpp::KSeq> batch;  // a whole chunk is parsed before it is enqueued in bulk
+    std::vector<PackedSeq> packedBatch;
+    RecordFilters::Tally tally;
+  };
 
   // Helper functions
   int loadIndex(const std::string& indexFileName);
+  void initParseState(ParseState& state, moodycamel::ProducerToken* token);
+  // Parses the len extracted bytes at buf (chunk's arena in chunk mode), filters and enqueues the records.
+  // Returns the time it finished
+  uint64_t parseChunk(ParseState& state, unsigned char* buf, int len, uint64_t startRecordIdx, RecordChunk* chunk,
+                      parserstats::ProducerCounters& stats, Tracer::ThreadBuffer* trace);
+  void sizePipeline(uint64_t maxBufLen);
   uint64_t getMaxBufLen();
+  int mapInput();
+  using WorkspacePtr = std::unique_ptr<extract_workspace_t, void (*)(extract_workspace_t*)>;
+  // A thread's extraction workspace with its output buffer grown to bufLen, or nullptr (reported) on failure
+  WorkspacePtr openWorkspace(uint64_t bufLen);
+  // Extracts the chunk starting at startRecordIdx into buf, or into the workspace's buffer when buf is nullptr
+  std::pair<unsigned char*, int> extractChunk(extract_workspace_t* ws, uint64_t startRecordIdx, unsigned char* buf,
+                                              extract_stats_t* extracted);
+  bool claimChunk(uint64_t& startRecordIdx);
+  // pool.acquire(), adding the time spent blocked on a full pool to stats.waitNs (and to *waited if given)
+  template <typename T>
+  T* acquireFrom(ChunkPool<T>& pool, parserstats::ProducerCounters& stats, uint64_t* waited = nullptr);
+  void recordExtract(parserstats::ProducerCounters& stats, const extract_stats_t& extracted, uint64_t ns);
+  void updateHighWaterMark();
+  uint64_t queueDepth();
+  void wakeWaiters();
+  void prefetchAhead(int fd, uint64_t startRecordIdx, parserstats::ProducerCounters& stats);
+  void traceExtract(Tracer::ThreadBuffer* trace, int64_t chunk, uint64_t claimStart, uint64_t openStart,
+                    const extract_stats_t& extracted);
 };
 
 #include "parser.inl"
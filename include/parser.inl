@@ -2,6 +2,7 @@ ParrFQParser::~ParrFQParser() {
   if (m_isRunning) {
     stop();
   }
+  gz_mapping_close(&m_mapping);
 }
 
 int ParrFQParser::init (const std::string& fastqFilename, const std::string& indexFileName, uint64_t perThreadReads, uint64_t numThreads) {
@@ -12,52 +13,366 @@ int ParrFQParser::init (const std::string& fastqFilename, const std::string& ind
   m_currMaxOffset = 0;
 
   m_readQueue = std::make_unique<moodycamel::ConcurrentQueue<klibpp::KSeq>>();
+  m_packedQueue = std::make_unique<moodycamel::ConcurrentQueue<PackedSeq>>();
+  m_chunkQueue = std::make_unique<moodycamel::ConcurrentQueue<RecordChunk*>>();
+  m_batchQueue = std::make_unique<moodycamel::ConcurrentQueue<RecordBatch*>>();
 
   for (uint64_t i = 0; i < m_numThreads; ++i) {
     m_producerTokens.emplace_back(std::make_unique<moodycamel::ProducerToken>(*m_readQueue));
+    m_producerStats.emplace_back(std::make_unique<parserstats::ProducerCounters>());
   }
 
   return 0;
 }
 
-int ParrFQParser::parse_reads(uint64_t threadId, moodycamel::ProducerToken* token, uint64_t maxBufLen) {
-  // Load the index file
-  // Create a shallow copy of the index object for each thread
-  // Do not call deflate_index_free on this object - TODO: This might be a memory leak
-  struct deflate_index* indexPerThread = new struct deflate_index(*m_index);
+void ParrFQParser::setPackedOutput(bool packed, bool keepQual) {
+  m_packedOutput = packed;
+  m_keepQual = keepQual;
+}
 
-  unsigned char* buf = new unsigned char[maxBufLen];
-  int got;
+void ParrFQParser::setChunkOutput(bool chunks, size_t maxChunks) {
+  m_chunkOutput = chunks;
+  m_maxChunks = maxChunks;
+}
 
-  while (true) {
-    uint64_t startRecordIdx = m_currMaxOffset.fetch_add(this->m_perThreadReads);
-    if (startRecordIdx >= indexPerThread->num_records) {
-      // All records in the file have been or are being processed
-      // This thread has nothing more to do
-      break;
+void ParrFQParser::addFilter(const std::string& name, RecordPredicate keep) {
+  m_filters.add(name, std::move(keep));
+}
+
+void ParrFQParser::setFields(unsigned fields) {
+  m_fields = fields;
+}
+
+void ParrFQParser::setBatchOutput(bool batches, size_t maxBatches) {
+  m_batchOutput = batches;
+  m_maxBatches = maxBatches;
+}
+
+void ParrFQParser::setPipeline(bool pipeline, uint64_t inflaters, uint64_t parsers) {
+  m_pipeline = pipeline;
+  m_inflaters = inflaters;
+  m_parsers = parsers;
+}
+
+void ParrFQParser::initParseState(ParseState& state, moodycamel::ProducerToken* token) {
+  state.token = token;
+  // Packed records, chunks and batches go to their own queues, so this thread needs a token for that queue
+  if (m_packedOutput) {
+    state.outputToken = std::make_unique<moodycamel::ProducerToken>(*m_packedQueue);
+  } else if (m_chunkOutput) {
+    state.outputToken = std::make_unique<moodycamel::ProducerToken>(*m_chunkQueue);
+  } else if (m_batchOutput) {
+    state.outputToken = std::make_unique<moodycamel::ProducerToken>(*m_batchQueue);
+  }
+  // A token is only invalid if the queue could not allocate its producer
+  if (!state.token->valid() || (state.outputToken != nullptr && !state.outputToken->valid())) throw std::bad_alloc();
+  state.tally = m_filters.tally();
+}
+
+uint64_t ParrFQParser::parseChunk(ParseState& state, unsigned char* buf, int got, uint64_t startRecordIdx,
+                                  RecordChunk* chunk, parserstats::ProducerCounters& stats,
+                                  Tracer::ThreadBuffer* trace) {
+  uint64_t t1 = parserstats::nowNs();
+  bool filtering = !m_filters.empty();
+  auto keep = [this, &state](const RecordView& rec) { return m_filters.keep(rec, state.tally); };
+
+  // parsed counts every record of the chunk, n only those that passed the filters and get enqueued
+  size_t n = 0;
+  uint64_t waitNs = 0;
+  size_t parsed = 0;
+  RecordBatch* batchOut = nullptr;
+  if (chunk != nullptr) {
+    chunk->size = got;
+    chunk->firstRecord = startRecordIdx;
+    parsed = chunk->parse((*m_index->record_boundaries)[startRecordIdx]);
+    if (filtering) {
+      chunk->records.erase(std::remove_if(chunk->records.begin(), chunk->records.end(),
+                                          [&keep](const RecordView& rec) { return !keep(rec); }),
+                           chunk->records.end());
+    }
+    n = chunk->records.size();
+  } else if (m_batchOutput) {
+    batchOut = acquireFrom(*m_batchPool, stats, &waitNs);
+    batchOut->firstRecord = startRecordIdx;
+    parsed = filtering ? batchOut->fill(reinterpret_cast<char*>(buf), got, m_fields, keep)
+                       : batchOut->fill(reinterpret_cast<char*>(buf), got, m_fields);
+    n = batchOut->size();
+  } else if (m_packedOutput) {
+    // Packed from views into the extracted buffer, so no sequence string is built for a record
+    RecordViewScanner scanner(reinterpret_cast<char*>(buf), got, (*m_index->record_boundaries)[startRecordIdx]);
+    RecordView rec;
+    while (scanner.next(rec)) {
+      ++parsed;
+      if (filtering && !keep(rec)) continue;
+      if (n == state.packedBatch.size()) state.packedBatch.emplace_back();
+      pack_record(rec, state.packedBatch[n++], m_fields, m_keepQual);
+    }
+  } else {
+    KseqCharStreamIn in(reinterpret_cast<const char*>(buf), got);
+    in.set_fields(m_fields);
+    while (true) {
+      if (n == state.batch.size()) state.batch.emplace_back();
+      if (!(in >> state.batch[n])) break;
+      ++parsed;
+      // A rejected record's slot is parsed over by the next one
+      if (!filtering || keep(viewOf(state.batch[n]))) ++n;
+    }
+  }
+  if (filtering) m_filters.flush(state.tally);
+  uint64_t t2 = parserstats::nowNs();
+  // The packed, chunk and batch queues are fed through outputToken, the record queue through token
+  if (chunk != nullptr) {
+    m_chunkQueue->enqueue(*state.outputToken, chunk);
+  } else if (batchOut != nullptr) {
+    m_batchQueue->enqueue(*state.outputToken, batchOut);
+  } else if (n == 0) {
+    // Every record was filtered out
+  } else {
+// enqueue_bulk() static_casts the token's producer without a null check, and GCC 12 warns about the write
+// through the null pointer it cannot rule out. Tokens are valid here: initParseState() checks them
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wstringop-overflow"
+    if (m_packedOutput) {
+      m_packedQueue->enqueue_bulk(*state.outputToken, std::make_move_iterator(state.packedBatch.begin()), n);
+    } else {
+      m_readQueue->enqueue_bulk(*state.token, std::make_move_iterator(state.batch.begin()), n);
     }
+#pragma GCC diagnostic pop
+  }
+  uint64_t t3 = parserstats::nowNs();
+  parserstats::add(stats.recordsParsed, parsed);
+  parserstats::add(stats.parseNs, t2 - t1 - waitNs);
+  parserstats::add(stats.enqueueNs, t3 - t2);
+  updateHighWaterMark();
+  wakeWaiters();
+  if (trace != nullptr) {
+    trace->span("parse", t1, t2, startRecordIdx);
+    trace->span("enqueue", t2, t3, startRecordIdx);
+  }
+  return t3;
+}
 
-    off_t numRecords = this->m_perThreadReads;
-    std::tie(buf, got) = read_index(m_fastqFilename.c_str(), indexPerThread, startRecordIdx, numRecords, buf);
+int ParrFQParser::parse_reads(uint64_t threadId, moodycamel::ProducerToken* token, uint64_t maxBufLen) {
+  // All of this thread's extraction state, set up once and reused for every chunk. In chunk mode the records
+  // are extracted into the chunks, so the workspace needs no output buffer
+  WorkspacePtr ws = openWorkspace(m_chunkOutput ? 0 : maxBufLen);
+  if (ws == nullptr) {
+    --m_numActiveThreads;
+    wakeWaiters();
+    return -1;
+  }
+  int got;
+
+  parserstats::ProducerCounters& stats = *m_producerStats[threadId];
+  ParseState state;
+  initParseState(state, token);
+  Tracer::ThreadBuffer* trace = m_tracer ? m_tracer->registerThread("producer " + std::to_string(threadId)) : nullptr;
+  int prefetchFd = m_prefetch ? open(m_fastqFilename.c_str(), O_RDONLY) : -1;
+
+  uint64_t startRecordIdx;
+  uint64_t claimStart = parserstats::nowNs();
+  while (claimChunk(startRecordIdx)) {
+    parserstats::add(stats.chunksClaimed, 1);
+
+    extract_stats_t extracted;
+    prefetchAhead(prefetchFd, startRecordIdx, stats);
+    // In chunk mode the chunk's buffer is the extraction target, and stays the records' storage
+    RecordChunk* chunk = m_chunkOutput ? acquireFrom(*m_chunkPool, stats) : nullptr;
+    unsigned char* target = chunk != nullptr ? reinterpret_cast<unsigned char*>(chunk->arena.get()) : nullptr;
+    uint64_t t0 = parserstats::nowNs();
+    std::tie(target, got) = extractChunk(ws.get(), startRecordIdx, target, &extracted);
+    uint64_t t1 = parserstats::nowNs();
     if (got < 0) {
       fprintf(stderr, "[%llu] Parsing failed failed: %s error\n", threadId,
               got == Z_MEM_ERROR ? "out of memory" : "input corrupted");
+      if (chunk != nullptr) m_chunkPool->release(chunk);
+      if (prefetchFd >= 0) close(prefetchFd);
       --m_numActiveThreads;
+      wakeWaiters();
       return -1;
     }
-    KseqCharStreamIn in(reinterpret_cast<const char*>(buf), got);
+    recordExtract(stats, extracted, t1 - t0);
+    if (trace != nullptr) traceExtract(trace, startRecordIdx, claimStart, t0, extracted);
+    claimStart = parseChunk(state, target, got, startRecordIdx, chunk, stats, trace);
+  }
+
+  if (prefetchFd >= 0) close(prefetchFd);
+  --m_numActiveThreads;
+  wakeWaiters();
+  return 0;
+}
+
+int ParrFQParser::inflate_chunks(uint64_t threadId) {
+  // Extracts straight into the pool's chunks, so the workspace needs no output buffer
+  WorkspacePtr ws = openWorkspace(0);
+  if (ws == nullptr) {
+    --m_activeInflaters;
+    return -1;
+  }
+  RecordChunkPool& pool = m_chunkOutput ? *m_chunkPool : *m_rawPool;
+  parserstats::ProducerCounters& stats = *m_producerStats[threadId];
+  Tracer::ThreadBuffer* trace = m_tracer ? m_tracer->registerThread("inflater " + std::to_string(threadId)) : nullptr;
+  int prefetchFd = m_prefetch ? open(m_fastqFilename.c_str(), O_RDONLY) : -1;
+  moodycamel::ProducerToken token(*m_rawQueue);
+  int status = 0;
+
+  uint64_t startRecordIdx;
+  uint64_t claimStart = parserstats::nowNs();
+  while (claimChunk(startRecordIdx)) {
+    parserstats::add(stats.chunksClaimed, 1);
+    extract_stats_t extracted;
+    prefetchAhead(prefetchFd, startRecordIdx, stats);
+    RecordChunk* raw = acquireFrom(pool, stats);
+    unsigned char* target = reinterpret_cast<unsigned char*>(raw->arena.get());
+    int got;
+    uint64_t t0 = parserstats::nowNs();
+    std::tie(target, got) = extractChunk(ws.get(), startRecordIdx, target, &extracted);
+    uint64_t t1 = parserstats::nowNs();
+    if (got < 0) {
+      fprintf(stderr, "[%lu] Inflating failed: %s error\n", threadId,
+              got == Z_MEM_ERROR ? "out of memory" : "input corrupted");
+      pool.release(raw);
+      status = -1;
+      break;
+    }
+    recordExtract(stats, extracted, t1 - t0);
+    raw->size = got;
+    raw->firstRecord = startRecordIdx;
+    m_rawQueue->enqueue(token, raw);
+    if (trace != nullptr) traceExtract(trace, startRecordIdx, claimStart, t0, extracted);
+    claimStart = parserstats::nowNs();
+  }
+
+  if (prefetchFd >= 0) close(prefetchFd);
+  --m_activeInflaters;
+  return status;
+}
+
+int ParrFQParser::parse_chunks(uint64_t threadId, moodycamel::ProducerToken* token) {
+  parserstats::ProducerCounters& stats = *m_producerStats[m_inflaters + threadId];
+  ParseState state;
+  initParseState(state, token);
+  Tracer::ThreadBuffer* trace = m_tracer ? m_tracer->registerThread("parser " + std::to_string(threadId)) : nullptr;
+  moodycamel::ConsumerToken rawToken(*m_rawQueue);
 
-    klibpp::KSeq rec;
-    while (in >> rec) {
-      m_readQueue->enqueue(*token, rec);
+  uint64_t waitStart = parserstats::nowNs();
+  while (true) {
+    RecordChunk* raw;
+    if (!m_rawQueue->wait_dequeue_timed(rawToken, raw, 1000)) {
+      // Every enqueue happened before the last inflater left, so an empty queue after that is final
+      if (m_activeInflaters != 0) continue;
+      if (!m_rawQueue->try_dequeue(rawToken, raw)) break;
+    }
+    uint64_t t0 = parserstats::nowNs();
+    parserstats::add(stats.waitNs, t0 - waitStart);
+    if (trace != nullptr) trace->span("wait", waitStart, t0, raw->firstRecord);
+    if (m_chunkOutput) {
+      waitStart = parseChunk(state, reinterpret_cast<unsigned char*>(raw->arena.get()), raw->size, raw->firstRecord,
+                             raw, stats, trace);
+    } else {
+      waitStart = parseChunk(state, reinterpret_cast<unsigned char*>(raw->arena.get()), raw->size, raw->firstRecord,
+                             nullptr, stats, trace);
+      m_rawPool->release(raw);
     }
   }
+  parserstats::add(stats.waitNs, parserstats::nowNs() - waitStart);
 
-  delete[] buf;
   --m_numActiveThreads;
+  wakeWaiters();
   return 0;
 }
 
+template <typename T, typename Kernel, typename Merge>
+int ParrFQParser::mapReduce(Kernel kernel, Merge merge, T& result) {
+  return mapReduceChunks<T>(
+      [&kernel](char* buf, size_t len, uint64_t, T& partial) { kernel(buf, len, partial); }, merge, result);
+}
+
+template <typename T, typename Kernel, typename Merge>
+int ParrFQParser::mapReduceChunks(Kernel kernel, Merge merge, T& result) {
+  if (m_isRunning) {
+    std::cout << "ParrFQParser is already running" << std::endl;
+    return -1;
+  }
+  if (m_index == nullptr) {
+    int ret = loadIndex(m_indexFileName);
+    if (ret != 0) return ret;
+  }
+  uint64_t maxBufLen = getMaxBufLen();
+  if (maxBufLen == 0) {
+    std::cout << "Error: Could not get the maximum buffer length" << std::endl;
+    return -1;
+  }
+  if (mapInput() != 0) return -1;
+
+  m_currMaxOffset = 0;
+  std::vector<T> partials(m_numThreads);
+  std::vector<int> status(m_numThreads, 0);
+  std::vector<std::thread> workers;
+  for (uint64_t i = 0; i < m_numThreads; ++i) {
+    workers.emplace_back([this, i, maxBufLen, &kernel, &partials, &status]() {
+      WorkspacePtr ws = openWorkspace(maxBufLen);
+      if (ws == nullptr) {
+        status[i] = -1;
+        return;
+      }
+      unsigned char* buf;
+      int got;
+      parserstats::ProducerCounters& stats = *m_producerStats[i];
+      Tracer::ThreadBuffer* trace = m_tracer ? m_tracer->registerThread("reducer " + std::to_string(i)) : nullptr;
+      int prefetchFd = m_prefetch ? open(m_fastqFilename.c_str(), O_RDONLY) : -1;
+      uint64_t startRecordIdx;
+      uint64_t claimStart = parserstats::nowNs();
+      while (claimChunk(startRecordIdx)) {
+        parserstats::add(stats.chunksClaimed, 1);
+        extract_stats_t extracted;
+        prefetchAhead(prefetchFd, startRecordIdx, stats);
+        uint64_t t0 = parserstats::nowNs();
+        std::tie(buf, got) = extractChunk(ws.get(), startRecordIdx, nullptr, &extracted);
+        uint64_t t1 = parserstats::nowNs();
+        if (got < 0) {
+          fprintf(stderr, "[%lu] Reduce failed: %s error\n", i, got == Z_MEM_ERROR ? "out of memory" : "input corrupted");
+          status[i] = -1;
+          break;
+        }
+        recordExtract(stats, extracted, t1 - t0);
+        kernel(reinterpret_cast<char*>(buf), static_cast<size_t>(got), startRecordIdx, partials[i]);
+        uint64_t t2 = parserstats::nowNs();
+        parserstats::add(stats.parseNs, t2 - t1);
+        if (trace != nullptr) {
+          traceExtract(trace, startRecordIdx, claimStart, t0, extracted);
+          trace->span("reduce", t1, t2, startRecordIdx);
+        }
+        claimStart = t2;
+      }
+      if (prefetchFd >= 0) close(prefetchFd);
+    });
+  }
+  for (auto& t : workers) {
+    t.join();
+  }
+
+  for (uint64_t i = 0; i < m_numThreads; ++i) {
+    if (status[i] != 0) return status[i];
+    merge(result, partials[i]);
+  }
+  return 0;
+}
+
+template <typename T, typename Kernel, typename Merge>
+int ParrFQParser::mapReduceRecords(Kernel kernel, Merge merge, T& result) {
+  // The index is loaded by mapReduceChunks(), so the chunk's file offset is looked up per chunk
+  return mapReduceChunks<T>(
+      [this, &kernel](char* buf, size_t len, uint64_t startRecordIdx, T& partial) {
+        RecordViewScanner scanner(buf, len, (*m_index->record_boundaries)[startRecordIdx]);
+        RecordView rec;
+        while (scanner.next(rec)) {
+          kernel(rec, partial);
+        }
+      },
+      merge, result);
+}
+
 int ParrFQParser::start() {
   if (m_isRunning == true) {
     std::cout << "ParrFQParser is already running" << std::endl;
@@ -75,15 +390,45 @@ int ParrFQParser::start() {
     std::cout << "Error: Could not get the maximum buffer length" << std::endl;
     return -1;
   }
+  if (mapInput() != 0) return -1;
+  if (m_chunkOutput && m_chunkPool == nullptr) {
+    size_t maxChunks = m_maxChunks != 0 ? m_maxChunks : 2 * m_numThreads;
+    m_chunkPool = std::make_unique<RecordChunkPool>(maxChunks, [maxBufLen]() { return new RecordChunk(maxBufLen); });
+  }
+  if (m_batchOutput && m_batchPool == nullptr) {
+    size_t maxBatches = m_maxBatches != 0 ? m_maxBatches : 2 * m_numThreads;
+    m_batchPool = std::make_unique<RecordBatchPool>(maxBatches, []() { return new RecordBatch(); });
+  }
 
+  // A mapReduce() before this one leaves the claim cursor at the end of the file
+  m_currMaxOffset = 0;
+  // Set before the producers start, so that a consumer woken by the last producer sees checkFinished()
+  m_isRunning = true;
+  if (m_pipeline) {
+    m_numActiveThreads = 1;  // sizePipeline() may parse the first chunk
+    m_rawQueue = std::make_unique<moodycamel::BlockingConcurrentQueue<RecordChunk*>>();
+    sizePipeline(maxBufLen);
+    if (!m_chunkOutput) {
+      m_rawPool = std::make_unique<RecordChunkPool>(m_inflaters + 2 * m_parsers,
+                                                    [maxBufLen]() { return new RecordChunk(maxBufLen); });
+    }
+    m_activeInflaters = m_inflaters;
+    m_numActiveThreads = m_parsers;
+    for (uint64_t i = 0; i < m_inflaters; ++i) {
+      m_workers.emplace_back(new std::thread([this, i]() { this->inflate_chunks(i); }));
+    }
+    for (uint64_t i = 0; i < m_parsers; ++i) {
+      m_workers.emplace_back(new std::thread([this, i]() { this->parse_chunks(i, m_producerTokens[i].get()); }));
+    }
+    return 0;
+  }
+  m_numActiveThreads = m_numThreads;
   // TODO: Save the result of each thread in a vector and return it
   for (uint64_t i = 0; i < m_numThreads; ++i) {
-    ++m_numActiveThreads;
     m_workers.emplace_back(new std::thread([this, i, maxBufLen]() {
       this->parse_reads(i, m_producerTokens[i].get(), maxBufLen);
     }));
   }
-  m_isRunning = true;
   return 0;
 }
 
@@ -92,13 +437,111 @@ int ParrFQParser::stop() {
     std::cout << "ParrFQParser is not running" << std::endl;
     return -1;
   }
-  for (uint64_t i = 0; i < m_numThreads; ++i) {
-    m_workers[i]->join();
+  for (auto& worker : m_workers) {
+    worker->join();
   }
+  m_workers.clear();
   m_isRunning = false;
   return 0;
 }
 
+ParrFQParser::Consumer ParrFQParser::getConsumer() {
+  std::lock_guard<std::mutex> lock(m_consumerStatsMutex);
+  m_consumerStats.emplace_back(std::make_unique<parserstats::ConsumerCounters>());
+  return Consumer(this, m_consumerStats.back().get());
+}
+
+ParrFQParser::Consumer::Consumer(ParrFQParser* parser, parserstats::ConsumerCounters* counters)
+    : m_parser(parser),
+      m_counters(counters),
+      m_token(*parser->m_readQueue),
+      m_packedToken(*parser->m_packedQueue),
+      m_chunkToken(*parser->m_chunkQueue),
+      m_batchToken(*parser->m_batchQueue) {
+  if (parser->m_tracer) {
+    m_trace = parser->m_tracer->registerThread("consumer " + std::to_string(parser->m_consumerStats.size() - 1));
+  }
+}
+
+template <typename Queue, typename Rec>
+bool ParrFQParser::Consumer::dequeue(Queue& queue, moodycamel::ConsumerToken& token, Rec& rec) {
+  uint64_t t0 = parserstats::nowNs();
+  bool found = queue.try_dequeue(token, rec);
+  account(found ? 1 : 0, t0, parserstats::nowNs());
+  return found;
+}
+
+size_t ParrFQParser::Consumer::getReads(std::vector<klibpp::KSeq>& batch, size_t max) {
+  batch.resize(max);
+  uint64_t t0 = parserstats::nowNs();
+  size_t n = m_parser->m_readQueue->try_dequeue_bulk(m_token, batch.begin(), max);
+  account(n, t0, parserstats::nowNs());
+  batch.resize(n);
+  return n;
+}
+
+void ParrFQParser::Consumer::account(size_t n, uint64_t t0, uint64_t t1) {
+  if (n > 0) {
+    parserstats::add(m_counters->recordsDequeued, n);
+    parserstats::add(m_counters->dequeueNs, t1 - t0);
+    if (m_idleSince != 0) {
+      parserstats::add(m_counters->idleNs, t1 - m_idleSince);
+      if (m_trace != nullptr) m_trace->span("idle", m_idleSince, t1);
+      m_idleSince = 0;
+    }
+    if (m_busySince == 0) m_busySince = t1;
+  } else {
+    parserstats::add(m_counters->emptyPolls, 1);
+    if (m_idleSince == 0) m_idleSince = t0;
+    // The trace shows runs of records between two empty polls, not every record
+    if (m_busySince != 0) {
+      if (m_trace != nullptr) m_trace->span("process", m_busySince, t0);
+      m_busySince = 0;
+    }
+  }
+}
+
+bool ParrFQParser::Consumer::getRead(klibpp::KSeq& rec) {
+  return dequeue(*m_parser->m_readQueue, m_token, rec);
+}
+
+bool ParrFQParser::Consumer::getPackedRead(PackedSeq& rec) {
+  return dequeue(*m_parser->m_packedQueue, m_packedToken, rec);
+}
+
+bool ParrFQParser::Consumer::getChunk(RecordChunkPtr& chunk) {
+  uint64_t t0 = parserstats::nowNs();
+  RecordChunk* next;
+  bool found = m_parser->m_chunkQueue->try_dequeue(m_chunkToken, next);
+  account(found ? next->records.size() : 0, t0, parserstats::nowNs());
+  if (found) chunk = m_parser->m_chunkPool->wrap(next);
+  return found;
+}
+
+bool ParrFQParser::Consumer::getBatch(RecordBatchPtr& batch) {
+  uint64_t t0 = parserstats::nowNs();
+  RecordBatch* next;
+  bool found = m_parser->m_batchQueue->try_dequeue(m_batchToken, next);
+  account(found ? next->size() : 0, t0, parserstats::nowNs());
+  if (found) batch = m_parser->m_batchPool->wrap(next);
+  return found;
+}
+
+bool ParrFQParser::Consumer::finished() {
+  if (!m_parser->checkFinished()) return false;
+  if (m_idleSince != 0) {
+    uint64_t now = parserstats::nowNs();
+    parserstats::add(m_counters->idleNs, now - m_idleSince);
+    if (m_trace != nullptr) m_trace->span("idle", m_idleSince, now);
+    m_idleSince = 0;
+  }
+  return true;
+}
+
+bool ParrFQParser::Consumer::ready() {
+  return m_parser->queueDepth() > 0 || m_parser->checkFinished();
+}
+
 moodycamel::ConsumerToken ParrFQParser::getConsumerToken() {
   return moodycamel::ConsumerToken(*m_readQueue);
 }
@@ -109,9 +552,165 @@ bool ParrFQParser::getRead(moodycamel::ConsumerToken& token, klibpp::KSeq& rec)
   return found;
 }
 
+moodycamel::ConsumerToken ParrFQParser::getPackedConsumerToken() {
+  return moodycamel::ConsumerToken(*m_packedQueue);
+}
+
+bool ParrFQParser::getPackedRead(moodycamel::ConsumerToken& token, PackedSeq& rec) {
+  // Same contract as getRead(), for parsers started with setPackedOutput(true)
+  return m_packedQueue->try_dequeue(token, rec);
+}
+
 bool ParrFQParser::checkFinished() {
-  // Checks if the parser has finished parsing all the reads and all threads have enqued all the reads
-  return m_isRunning == true && m_numActiveThreads == 0;
+  // Checks if the parser has finished parsing all the reads and all threads have enqued all the reads.
+  // Once the producers are done the queue sizes are exact, so a consumer whose dequeue raced with the
+  // last enqueue keeps going until the queues are drained.
+  return m_isRunning == true && m_numActiveThreads == 0 && queueDepth() == 0;
+}
+
+ParserStats ParrFQParser::stats() {
+  ParserStats s;
+  for (auto& p : m_producerStats) {
+    s.producers.push_back(p->snapshot());
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_consumerStatsMutex);
+    for (auto& c : m_consumerStats) {
+      s.consumers.push_back(c->snapshot());
+    }
+  }
+  if (m_readQueue != nullptr) {
+    s.queueDepth = queueDepth();
+  }
+  s.queueHighWaterMark = m_queueHighWaterMark.load(std::memory_order_relaxed);
+  s.filters = m_filters.stats();
+  return s;
+}
+
+void ParrFQParser::recordExtract(parserstats::ProducerCounters& stats, const extract_stats_t& extracted, uint64_t ns) {
+  parserstats::add(stats.bytesRead, extracted.bytes_read);
+  parserstats::add(stats.bytesInflated, extracted.bytes_inflated);
+  parserstats::add(stats.bytesDiscarded, extracted.bytes_discarded);
+  parserstats::add(stats.extractNs, ns);
+}
+
+void ParrFQParser::setPrefetch(bool prefetch) {
+  m_prefetch = prefetch;
+}
+
+void ParrFQParser::prefetchAhead(int fd, uint64_t startRecordIdx, parserstats::ProducerCounters& stats) {
+  // Chunks are claimed in order, so while the producers work on one round of chunks the next round is
+  // startRecordIdx + numThreads * perThreadReads away. Each producer prefetches the chunk that lies one round
+  // ahead of its own: every chunk is requested once, about one chunk's processing time before it is claimed.
+  if (fd < 0) return;
+  uint64_t next = startRecordIdx + m_numThreads * m_perThreadReads;
+  if (next >= static_cast<uint64_t>(m_index->num_records)) return;
+  off_t offset = (*m_index->record_boundaries)[next];
+  off_t len = get_read_len(m_index.get(), next, m_perThreadReads);
+  off_t start, end;
+  if (deflate_index_compressed_range(m_index.get(), offset, len, &start, &end) != 0) return;
+  if (posix_fadvise(fd, start, end == 0 ? 0 : end - start, POSIX_FADV_WILLNEED) == 0 && end != 0) {
+    parserstats::add(stats.bytesPrefetched, end - start);
+  }
+}
+
+void ParrFQParser::setMmapInput(bool mmapInput) {
+  m_mmapInput = mmapInput;
+}
+
+int ParrFQParser::mapInput() {
+  // The mapping is shared by all producers and kept until the parser is destroyed
+  if (!m_mmapInput || m_mapping.data != NULL) return 0;
+  if (gz_mapping_open(m_fastqFilename.c_str(), &m_mapping) != 0) {
+    fprintf(stderr, "Could not map %s into memory\n", m_fastqFilename.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+ParrFQParser::WorkspacePtr ParrFQParser::openWorkspace(uint64_t bufLen) {
+  // Extracts from the mapping when there is one, else through its own FILE
+  WorkspacePtr ws(extract_workspace_open(m_index.get(), m_fastqFilename.c_str(), &m_mapping), extract_workspace_close);
+  if (ws == nullptr) {
+    fprintf(stderr, "Could not open %s\n", m_fastqFilename.c_str());
+  } else if (bufLen > 0 && extract_workspace_buffer(ws.get(), bufLen) == NULL) {
+    fprintf(stderr, "Could not allocate a %lu byte extraction buffer\n", bufLen);
+    ws.reset();
+  }
+  return ws;
+}
+
+template <typename T>
+T* ParrFQParser::acquireFrom(ChunkPool<T>& pool, parserstats::ProducerCounters& stats, uint64_t* waited) {
+  uint64_t t0 = parserstats::nowNs();
+  T* item = pool.acquire();
+  uint64_t ns = parserstats::nowNs() - t0;
+  parserstats::add(stats.waitNs, ns);
+  if (waited != nullptr) *waited += ns;
+  return item;
+}
+
+std::pair<unsigned char*, int> ParrFQParser::extractChunk(extract_workspace_t* ws, uint64_t startRecordIdx,
+                                                          unsigned char* buf, extract_stats_t* extracted) {
+  return read_index(ws, startRecordIdx, m_perThreadReads, buf, extracted);
+}
+
+void ParrFQParser::enableTracing() {
+  m_tracer = std::make_unique<Tracer>();
+}
+
+int ParrFQParser::writeTrace(const std::string& path) {
+  if (!m_tracer) {
+    std::cout << "Tracing was not enabled" << std::endl;
+    return -1;
+  }
+  return m_tracer->write(path);
+}
+
+void ParrFQParser::traceExtract(Tracer::ThreadBuffer* trace, int64_t chunk, uint64_t claimStart, uint64_t openStart,
+                                const extract_stats_t& extracted) {
+  trace->span("claim", claimStart, openStart, chunk);
+  trace->span("open", openStart, extracted.t_start, chunk);
+  trace->span("seek", extracted.t_start, extracted.t_seeked, chunk);
+  trace->span("prime", extracted.t_seeked, extracted.t_primed, chunk);
+  trace->span("discard inflate", extracted.t_primed, extracted.t_discarded, chunk);
+  trace->span("inflate", extracted.t_discarded, extracted.t_end, chunk);
+}
+
+void ParrFQParser::updateHighWaterMark() {
+  // Called once per enqueued chunk, so walking the producer lists in size_approx() is cheap enough
+  uint64_t depth = queueDepth();
+  uint64_t seen = m_queueHighWaterMark.load(std::memory_order_relaxed);
+  while (depth > seen && !m_queueHighWaterMark.compare_exchange_weak(seen, depth, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t ParrFQParser::queueDepth() {
+  // Only one of the queues is in use; in chunk and batch mode the depth counts chunks rather than records
+  return m_readQueue->size_approx() + m_packedQueue->size_approx() + m_chunkQueue->size_approx() +
+         m_batchQueue->size_approx();
+}
+
+void ParrFQParser::addWaiter(std::function<void()> wake) {
+  std::lock_guard<std::mutex> lock(m_waitersMutex);
+  m_waiters.push_back(std::move(wake));
+  m_hasWaiters = true;
+}
+
+void ParrFQParser::wakeWaiters() {
+  // Producers only take the lock when somebody is waiting. The fence pairs with the one a waiter issues
+  // between addWaiter() and re-checking the queue, so one of the two sides always sees the other.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!m_hasWaiters.load()) return;
+  std::vector<std::function<void()>> waiters;
+  {
+    std::lock_guard<std::mutex> lock(m_waitersMutex);
+    waiters.swap(m_waiters);
+    m_hasWaiters = false;
+  }
+  for (auto& wake : waiters) {
+    wake();
+  }
 }
 
 int ParrFQParser::loadIndex(const std::string& indexFileName) {
@@ -122,8 +721,8 @@ int ParrFQParser::loadIndex(const std::string& indexFileName) {
     return -1;
   }
   //int len = deflate_index_load(indexFile, &index);
-  gzFile index_file_gzip = gzopen(indexFileName.c_str(), "rb");
-  int len = deflate_index_load_gzip(index_file_gzip, &index);
+  // Windows of a plain index are read on demand and shared by the producers' index copies
+  int len = deflate_index_load_lazy(indexFileName.c_str(), &index);
   fclose(indexFile);
   if (len < 0) {
     fprintf(stderr, "Could not load index %d\n", len);
@@ -133,6 +732,71 @@ int ParrFQParser::loadIndex(const std::string& indexFileName) {
   return 0;
 }
 
+void ParrFQParser::sizePipeline(uint64_t maxBufLen) {
+  uint64_t budget = std::max<uint64_t>(m_numThreads, 2);
+  parserstats::ProducerCounters probe;
+  if (m_inflaters == 0 && m_parsers == 0) {
+    // Measure both stages on the first chunk, which is parsed and enqueued as usual
+    uint64_t startRecordIdx;
+    if (claimChunk(startRecordIdx)) {
+      parserstats::add(probe.chunksClaimed, 1);
+      RecordChunk* chunk = m_chunkOutput ? m_chunkPool->acquire() : nullptr;
+      WorkspacePtr ws = openWorkspace(chunk != nullptr ? 0 : maxBufLen);
+      if (ws != nullptr) {
+        unsigned char* target = chunk != nullptr ? reinterpret_cast<unsigned char*>(chunk->arena.get()) : nullptr;
+        extract_stats_t extracted;
+        int got;
+        uint64_t t0 = parserstats::nowNs();
+        std::tie(target, got) = extractChunk(ws.get(), startRecordIdx, target, &extracted);
+        recordExtract(probe, extracted, parserstats::nowNs() - t0);
+        if (got >= 0) {
+          ParseState state;
+          initParseState(state, m_producerTokens[0].get());
+          parseChunk(state, target, got, startRecordIdx, chunk, probe, nullptr);
+          chunk = nullptr;
+        } else {
+          fprintf(stderr, "Inflating failed: %s error\n", got == Z_MEM_ERROR ? "out of memory" : "input corrupted");
+        }
+      }
+      if (chunk != nullptr) m_chunkPool->release(chunk);
+    }
+    double extractNs = parserstats::get(probe.extractNs);
+    double parseNs = parserstats::get(probe.parseNs) + parserstats::get(probe.enqueueNs);
+    m_inflaters = extractNs + parseNs > 0 ? std::llround(budget * extractNs / (extractNs + parseNs)) : budget / 2;
+    m_inflaters = std::min(std::max<uint64_t>(m_inflaters, 1), budget - 1);
+    m_parsers = budget - m_inflaters;
+  } else if (m_inflaters == 0) {
+    m_inflaters = budget > m_parsers ? budget - m_parsers : 1;
+  } else if (m_parsers == 0) {
+    m_parsers = budget > m_inflaters ? budget - m_inflaters : 1;
+  }
+
+  // Inflaters take the first producer stats, parsers the next ones and the record queue tokens
+  while (m_producerStats.size() < m_inflaters + m_parsers) {
+    m_producerStats.emplace_back(std::make_unique<parserstats::ProducerCounters>());
+  }
+  while (m_producerTokens.size() < m_parsers) {
+    m_producerTokens.emplace_back(std::make_unique<moodycamel::ProducerToken>(*m_readQueue));
+  }
+  parserstats::ProducerCounters& inflater = *m_producerStats[0];
+  parserstats::ProducerCounters& parser = *m_producerStats[m_inflaters];
+  parserstats::add(inflater.chunksClaimed, parserstats::get(probe.chunksClaimed));
+  parserstats::add(inflater.bytesRead, parserstats::get(probe.bytesRead));
+  parserstats::add(inflater.bytesInflated, parserstats::get(probe.bytesInflated));
+  parserstats::add(inflater.bytesDiscarded, parserstats::get(probe.bytesDiscarded));
+  parserstats::add(inflater.extractNs, parserstats::get(probe.extractNs));
+  parserstats::add(parser.recordsParsed, parserstats::get(probe.recordsParsed));
+  parserstats::add(parser.parseNs, parserstats::get(probe.parseNs));
+  parserstats::add(parser.enqueueNs, parserstats::get(probe.enqueueNs));
+}
+
+bool ParrFQParser::claimChunk(uint64_t& startRecordIdx) {
+  // Each thread atomically bumps the shared record counter to claim the next m_perThreadReads records.
+  // Returns false once all records in the file have been or are being processed.
+  startRecordIdx = m_currMaxOffset.fetch_add(m_perThreadReads);
+  return startRecordIdx < static_cast<uint64_t>(m_index->num_records);
+}
+
 uint64_t ParrFQParser::getMaxBufLen() {
   if (m_index == nullptr) {
     return 0;
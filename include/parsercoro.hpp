@@ -0,0 +1,237 @@
+#pragma once
+// C++20 coroutine interface to ParrFQParser; compile with -std=c++20.
+//
+//   for (ReadBatch& batch : readBatches(parser, 1024)) { ... }    // one generator per consumer thread
+//
+//   DetachedTask consume(AsyncConsumer& c) {                      // many consumers on one executor thread
+//     ReadBatch batch;
+//     while (co_await c.next(batch)) { ... }
+//   }
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "parser.hpp"
+
+using ReadBatch = std::vector<klibpp::KSeq>;
+
+// Synchronous generator usable in a range-for loop. The yielded value may be modified or moved from.
+template <typename T>
+class Generator {
+ public:
+  struct promise_type {
+    T* value = nullptr;
+    std::exception_ptr error;
+
+    Generator get_return_object() { return Generator(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    std::suspend_always yield_value(T& v) noexcept {
+      value = &v;
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+  using Handle = std::coroutine_handle<promise_type>;
+
+  class iterator {
+   public:
+    explicit iterator(Handle h) : m_h(h) {}
+    iterator& operator++() {
+      advance(m_h);
+      return *this;
+    }
+    T& operator*() const { return *m_h.promise().value; }
+    bool operator==(std::default_sentinel_t) const { return m_h.done(); }
+
+   private:
+    Handle m_h;
+  };
+
+  explicit Generator(Handle h) : m_h(h) {}
+  Generator(Generator&& other) noexcept : m_h(std::exchange(other.m_h, {})) {}
+  Generator(const Generator&) = delete;
+  Generator& operator=(const Generator&) = delete;
+  ~Generator() {
+    if (m_h) m_h.destroy();
+  }
+
+  iterator begin() {
+    advance(m_h);
+    return iterator(m_h);
+  }
+  std::default_sentinel_t end() { return {}; }
+
+ private:
+  Handle m_h;
+
+  static void advance(Handle h) {
+    h.resume();
+    if (h.promise().error) std::rethrow_exception(h.promise().error);
+  }
+};
+
+// Batches of records for one consumer. Spins (yielding the thread) while the queue is empty, like the
+// getRead()/checkFinished() loop it replaces; use AsyncConsumer to suspend instead.
+inline Generator<ReadBatch> readBatches(ParrFQParser& parser, size_t batchSize) {
+  ParrFQParser::Consumer consumer = parser.getConsumer();
+  ReadBatch batch;
+  while (true) {
+    if (consumer.getReads(batch, batchSize) > 0) {
+      co_yield batch;
+    } else if (consumer.finished()) {
+      co_return;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+// Lazily started coroutine that resumes its awaiter when it completes
+template <typename T>
+class Task {
+ public:
+  struct promise_type {
+    T value{};
+    std::exception_ptr error;
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    auto final_suspend() noexcept {
+      struct Resume {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+          return h.promise().continuation;
+        }
+        void await_resume() noexcept {}
+      };
+      return Resume{};
+    }
+    void return_value(T v) { value = std::move(v); }
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+  using Handle = std::coroutine_handle<promise_type>;
+
+  explicit Task(Handle h) : m_h(h) {}
+  Task(Task&& other) noexcept : m_h(std::exchange(other.m_h, {})) {}
+  Task(const Task&) = delete;
+  ~Task() {
+    if (m_h) m_h.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    m_h.promise().continuation = awaiter;
+    return m_h;
+  }
+  T await_resume() {
+    if (m_h.promise().error) std::rethrow_exception(m_h.promise().error);
+    return std::move(m_h.promise().value);
+  }
+
+ private:
+  Handle m_h;
+};
+
+// Fire-and-forget top-level coroutine: starts immediately and frees itself when it finishes
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+// Where a suspended consumer is resumed. Called from a producer thread, so it should only hand the
+// coroutine over to the executor's own threads.
+using Executor = std::function<void(std::coroutine_handle<>)>;
+
+// A consumer whose next() suspends while the queue is empty, and is resumed through the executor once a
+// producer enqueues a chunk or the last producer exits.
+class AsyncConsumer {
+ public:
+  AsyncConsumer(ParrFQParser& parser, Executor executor, size_t batchSize = 1024)
+      : m_parser(parser), m_consumer(parser.getConsumer()), m_executor(std::move(executor)), m_batchSize(batchSize) {}
+  // Pending wake-ups point at this object
+  AsyncConsumer(const AsyncConsumer&) = delete;
+  AsyncConsumer& operator=(const AsyncConsumer&) = delete;
+
+  // co_await next(batch) is true with 1..batchSize records in batch, and false once the parser has finished
+  Task<bool> next(ReadBatch& batch) {
+    while (true) {
+      if (m_consumer.getReads(batch, m_batchSize) > 0) co_return true;
+      if (m_consumer.finished()) co_return false;
+      co_await WaitForRecords{this};
+    }
+  }
+
+ private:
+  struct WaitForRecords {
+    AsyncConsumer* self;
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h) {
+      // Exactly one of the producer's wake-up and the re-check below resumes the coroutine
+      auto claimed = std::make_shared<std::atomic<bool>>(false);
+      Executor* executor = &self->m_executor;
+      self->m_parser.addWaiter([claimed, executor, h]() {
+        if (!claimed->exchange(true)) (*executor)(h);
+      });
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (self->m_consumer.ready() && !claimed->exchange(true)) return false;
+      return true;
+    }
+    void await_resume() const noexcept {}
+  };
+
+  ParrFQParser& m_parser;
+  ParrFQParser::Consumer m_consumer;
+  Executor m_executor;
+  size_t m_batchSize;
+};
+
+// Single-threaded executor: coroutines posted from any thread are resumed by whoever calls runUntil()
+class ManualExecutor {
+ public:
+  Executor executor() {
+    return [this](std::coroutine_handle<> h) {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_ready.push_back(h);
+      }
+      m_cv.notify_one();
+    };
+  }
+
+  // done() is checked between resumptions, on the calling thread
+  void runUntil(const std::function<bool()>& done) {
+    while (!done()) {
+      std::coroutine_handle<> h;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() { return !m_ready.empty(); });
+        h = m_ready.front();
+        m_ready.pop_front();
+      }
+      h.resume();
+    }
+  }
+
+ private:
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<std::coroutine_handle<>> m_ready;
+};
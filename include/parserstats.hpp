@@ -0,0 +1,139 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Snapshot of one producer thread's counters. Times are in nanoseconds.
+struct ProducerStats {
+  uint64_t chunksClaimed = 0;
+  uint64_t recordsParsed = 0;
+  uint64_t bytesRead = 0;       // compressed bytes read from the file
+  uint64_t bytesInflated = 0;   // uncompressed bytes that were parsed
+  uint64_t bytesDiscarded = 0;  // uncompressed bytes inflated between the access point and the chunk start
+  uint64_t bytesPrefetched = 0; // compressed bytes of upcoming chunks passed to posix_fadvise(WILLNEED)
+  uint64_t extractNs = 0;       // seeking, priming and inflating (read_index)
+  uint64_t parseNs = 0;         // turning the extracted buffer into records (or running the mapReduce kernel)
+  uint64_t enqueueNs = 0;
+  uint64_t waitNs = 0;          // blocked on a full chunk or batch pool, or (pipeline parsers) on an empty raw queue
+};
+
+// Snapshot of one consumer's counters (see ParrFQParser::getConsumer())
+struct ConsumerStats {
+  uint64_t recordsDequeued = 0;
+  uint64_t emptyPolls = 0;  // getRead() calls that found the queue empty
+  uint64_t dequeueNs = 0;   // time in successful getRead() calls
+  uint64_t idleNs = 0;      // time between the first empty poll and the next record (or the end)
+};
+
+// Records that reached a producer-side filter (ParrFQParser::addFilter()) and were kept or dropped by it
+struct FilterStats {
+  std::string name;
+  uint64_t passed = 0;
+  uint64_t rejected = 0;
+};
+
+struct ParserStats {
+  std::vector<ProducerStats> producers;
+  std::vector<ConsumerStats> consumers;
+  std::vector<FilterStats> filters;
+  uint64_t queueDepth = 0;          // approximate number of records (chunks in chunk mode) waiting right now
+  uint64_t queueHighWaterMark = 0;  // largest depth seen after a producer enqueued a chunk
+
+  ProducerStats totalProducers() const {
+    ProducerStats t;
+    for (auto& p : producers) {
+      t.chunksClaimed += p.chunksClaimed;
+      t.recordsParsed += p.recordsParsed;
+      t.bytesRead += p.bytesRead;
+      t.bytesInflated += p.bytesInflated;
+      t.bytesDiscarded += p.bytesDiscarded;
+      t.bytesPrefetched += p.bytesPrefetched;
+      t.extractNs += p.extractNs;
+      t.parseNs += p.parseNs;
+      t.enqueueNs += p.enqueueNs;
+      t.waitNs += p.waitNs;
+    }
+    return t;
+  }
+
+  void print(std::ostream& os) const {
+    os << "producer\tchunks\trecords\tread_MB\tinflated_MB\tdiscarded_MB\tprefetched_MB\textract_ms\tparse_ms"
+       << "\tenqueue_ms\twait_ms\n";
+    for (size_t i = 0; i < producers.size(); ++i) {
+      const ProducerStats& p = producers[i];
+      os << i << '\t' << p.chunksClaimed << '\t' << p.recordsParsed << '\t' << p.bytesRead / 1e6 << '\t'
+         << p.bytesInflated / 1e6 << '\t' << p.bytesDiscarded / 1e6 << '\t' << p.bytesPrefetched / 1e6 << '\t'
+         << p.extractNs / 1e6 << '\t' << p.parseNs / 1e6 << '\t' << p.enqueueNs / 1e6 << '\t' << p.waitNs / 1e6
+         << '\n';
+    }
+    if (!consumers.empty()) {
+      os << "consumer\trecords\tempty_polls\tdequeue_ms\tidle_ms\n";
+      for (size_t i = 0; i < consumers.size(); ++i) {
+        const ConsumerStats& c = consumers[i];
+        os << i << '\t' << c.recordsDequeued << '\t' << c.emptyPolls << '\t' << c.dequeueNs / 1e6 << '\t'
+           << c.idleNs / 1e6 << '\n';
+      }
+    }
+    if (!filters.empty()) {
+      os << "filter\tpassed\trejected\n";
+      for (const FilterStats& f : filters) {
+        os << f.name << '\t' << f.passed << '\t' << f.rejected << '\n';
+      }
+    }
+    os << "queue depth " << queueDepth << ", high-water mark " << queueHighWaterMark << '\n';
+  }
+};
+
+namespace parserstats {
+
+inline uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Counters have a single writer, so a relaxed load and store is enough and costs no locked instruction;
+// stats() may read them from any thread while the parser runs.
+inline void add(std::atomic<uint64_t>& counter, uint64_t v) {
+  counter.store(counter.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+inline uint64_t get(const std::atomic<uint64_t>& counter) { return counter.load(std::memory_order_relaxed); }
+
+struct ProducerCounters {
+  std::atomic<uint64_t> chunksClaimed{0}, recordsParsed{0}, bytesRead{0}, bytesInflated{0}, bytesDiscarded{0},
+      bytesPrefetched{0};
+  std::atomic<uint64_t> extractNs{0}, parseNs{0}, enqueueNs{0}, waitNs{0};
+
+  ProducerStats snapshot() const {
+    ProducerStats s;
+    s.chunksClaimed = get(chunksClaimed);
+    s.recordsParsed = get(recordsParsed);
+    s.bytesRead = get(bytesRead);
+    s.bytesInflated = get(bytesInflated);
+    s.bytesDiscarded = get(bytesDiscarded);
+    s.bytesPrefetched = get(bytesPrefetched);
+    s.extractNs = get(extractNs);
+    s.parseNs = get(parseNs);
+    s.enqueueNs = get(enqueueNs);
+    s.waitNs = get(waitNs);
+    return s;
+  }
+};
+
+struct ConsumerCounters {
+  std::atomic<uint64_t> recordsDequeued{0}, emptyPolls{0}, dequeueNs{0}, idleNs{0};
+
+  ConsumerStats snapshot() const {
+    ConsumerStats s;
+    s.recordsDequeued = get(recordsDequeued);
+    s.emptyPolls = get(emptyPolls);
+    s.dequeueNs = get(dequeueNs);
+    s.idleNs = get(idleNs);
+    return s;
+  }
+};
+
+}  // namespace parserstats
@@ -0,0 +1,361 @@
+#pragma once
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "kseq++/kseq++.hpp"
+#include "zran.hpp"
+
+// Block-parallel gzip writer (pigz/BGZF style). Input is cut into blocks of blockSize bytes and
+// each block is deflated into its own gzip member by a pool of threads; a writer thread appends
+// the members to the file in input order. Concatenated members are a valid gzip file, readable by
+// gzip, zlib's gzread and kseq++. Blocks are independent, so every member start is an access point
+// that needs no dictionary.
+class ParallelGzWriter {
+ public:
+  static constexpr size_t DEFAULT_BLOCK_SIZE = 1 << 20;
+
+  ParallelGzWriter(const char* filename, unsigned numThreads = 0, size_t blockSize = DEFAULT_BLOCK_SIZE,
+                   int level = Z_DEFAULT_COMPRESSION)
+      : ParallelGzWriter(open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644), numThreads, blockSize, level) {}
+
+  ParallelGzWriter(int fd, unsigned numThreads = 0, size_t blockSize = DEFAULT_BLOCK_SIZE,
+                   int level = Z_DEFAULT_COMPRESSION)
+      : m_fd(fd), m_blockSize(blockSize), m_level(level) {
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    m_maxInFlight = 2 * numThreads;
+    m_failed = m_fd < 0;
+    for (unsigned i = 0; i < numThreads; ++i) {
+      m_compressors.emplace_back([this]() { compressLoop(); });
+    }
+    m_writer = std::thread([this]() { writeLoop(); });
+  }
+
+  ParallelGzWriter(const ParallelGzWriter&) = delete;
+  ParallelGzWriter& operator=(const ParallelGzWriter&) = delete;
+
+  // Subclasses overriding onMember() must call close() in their own destructor, while they are still whole
+  virtual ~ParallelGzWriter() { close(); }
+
+  // gzwrite() semantics: returns len, or 0 on error
+  int write(const void* data, unsigned len) {
+    if (m_failed) return 0;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    unsigned left = len;
+    while (left > 0) {
+      if (!m_current) m_current = takeFreeBlock();
+      size_t room = m_blockSize - m_current->in.size();
+      size_t n = left < room ? left : room;
+      m_current->in.insert(m_current->in.end(), p, p + n);
+      p += n;
+      left -= n;
+      if (m_current->in.size() == m_blockSize) submit();
+    }
+    return m_failed ? 0 : len;
+  }
+
+  // Ends the current block here, so that the next write starts a new gzip member
+  void endBlock() {
+    if (m_current && !m_current->in.empty()) submit();
+  }
+
+  // Flushes the last block, waits for all members to be written and closes the file.
+  // Returns 0 on success, -1 if any compression or write failed.
+  virtual int close() {
+    if (m_closed) return m_failed ? -1 : 0;
+    m_closed = true;
+    // An empty input still produces one (empty) member so that the output is valid gzip
+    if (m_current || m_blocksSubmitted == 0) {
+      if (!m_current) m_current = takeFreeBlock();
+      submit();
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_terminate = true;
+    }
+    m_jobsCv.notify_all();
+    m_doneCv.notify_all();
+    for (auto& t : m_compressors) t.join();
+    m_writer.join();
+    if (m_fd >= 0 && ::close(m_fd) != 0) m_failed = true;
+    m_fd = -1;
+    return m_failed ? -1 : 0;
+  }
+
+  bool failed() const { return m_failed; }
+
+  // Total bytes written so far, compressed and uncompressed
+  uint64_t compressedBytes() const { return m_compressedBytes; }
+  uint64_t uncompressedBytes() const { return m_uncompressedBytes; }
+
+ protected:
+  struct Block {
+    uint64_t seq = 0;
+    std::vector<unsigned char> in;
+    std::vector<unsigned char> out;
+    bool done = false;
+  };
+
+  // Called by the writer thread right before a member is appended to the file, with the compressed
+  // and uncompressed offsets at which the member starts.
+  virtual void onMember(uint64_t compressedOffset, uint64_t uncompressedOffset, const Block& block) {}
+
+ private:
+  int m_fd;
+  size_t m_blockSize;
+  int m_level;
+  size_t m_maxInFlight;
+  bool m_closed = false;
+  std::atomic<bool> m_failed{false};
+  uint64_t m_blocksSubmitted = 0;
+  uint64_t m_compressedBytes = 0;
+  uint64_t m_uncompressedBytes = 0;
+
+  std::unique_ptr<Block> m_current;
+  std::mutex m_mutex;
+  std::condition_variable m_jobsCv;   // compressors wait for jobs
+  std::condition_variable m_doneCv;   // writer waits for the oldest block to be compressed
+  std::condition_variable m_spaceCv;  // producer waits for an in-flight slot
+  std::deque<Block*> m_jobs;                         // blocks waiting for a compressor
+  std::deque<std::unique_ptr<Block>> m_inFlight;     // submitted blocks, in input order
+  std::vector<std::unique_ptr<Block>> m_free;        // recycled blocks, keep their capacity
+  bool m_terminate = false;
+  std::vector<std::thread> m_compressors;
+  std::thread m_writer;
+
+  std::unique_ptr<Block> takeFreeBlock() {
+    std::unique_ptr<Block> block;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (!m_free.empty()) {
+        block = std::move(m_free.back());
+        m_free.pop_back();
+      }
+    }
+    if (!block) {
+      block = std::make_unique<Block>();
+      block->in.reserve(m_blockSize);
+    }
+    block->in.clear();
+    block->done = false;
+    return block;
+  }
+
+  void submit() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_spaceCv.wait(lock, [this]() { return m_inFlight.size() < m_maxInFlight; });
+    m_current->seq = m_blocksSubmitted++;
+    m_jobs.push_back(m_current.get());
+    m_inFlight.push_back(std::move(m_current));
+    lock.unlock();
+    m_jobsCv.notify_one();
+  }
+
+  void compressLoop() {
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+    // windowBits 31 writes a plain 10 byte gzip header and the gzip trailer around every member
+    if (deflateInit2(&strm, m_level, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      m_failed = true;
+    }
+    while (true) {
+      Block* block;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_jobsCv.wait(lock, [this]() { return !m_jobs.empty() || m_terminate; });
+        if (m_jobs.empty()) break;
+        block = m_jobs.front();
+        m_jobs.pop_front();
+      }
+      if (!m_failed) {
+        deflateReset(&strm);
+        block->out.resize(deflateBound(&strm, block->in.size()));
+        strm.next_in = block->in.data();
+        strm.avail_in = block->in.size();
+        strm.next_out = block->out.data();
+        strm.avail_out = block->out.size();
+        if (deflate(&strm, Z_FINISH) != Z_STREAM_END) m_failed = true;
+        block->out.resize(block->out.size() - strm.avail_out);
+      }
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        block->done = true;
+      }
+      m_doneCv.notify_all();
+    }
+    deflateEnd(&strm);
+  }
+
+  void writeLoop() {
+    while (true) {
+      std::unique_ptr<Block> block;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_doneCv.wait(lock, [this]() { return (!m_inFlight.empty() && m_inFlight.front()->done) ||
+                                              (m_terminate && m_inFlight.empty()); });
+        if (m_inFlight.empty()) break;
+        block = std::move(m_inFlight.front());
+        m_inFlight.pop_front();
+      }
+      m_spaceCv.notify_one();
+
+      if (!m_failed) {
+        onMember(m_compressedBytes, m_uncompressedBytes, *block);
+        size_t written = 0;
+        while (written < block->out.size()) {
+          ssize_t n = ::write(m_fd, block->out.data() + written, block->out.size() - written);
+          if (n <= 0) {
+            m_failed = true;
+            break;
+          }
+          written += n;
+        }
+        m_compressedBytes += block->out.size();
+        m_uncompressedBytes += block->in.size();
+      }
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_free.push_back(std::move(block));
+    }
+  }
+};
+
+// Drop-in replacement for klibpp::SeqStreamOut that compresses with a ParallelGzWriter.
+// The KStreamOut background thread hands its buffers to the writer, which cuts them into
+// blocks for the compression pool.
+class ParSeqStreamOut
+    : public klibpp::KStreamOut<ParallelGzWriter*, int (*)(ParallelGzWriter*, const void*, unsigned int)> {
+ public:
+  using base_type = klibpp::KStreamOut<ParallelGzWriter*, int (*)(ParallelGzWriter*, const void*, unsigned int)>;
+
+  ParSeqStreamOut(const char* filename, klibpp::format::Format fmt = base_type::DEFAULT_FORMAT,
+                  unsigned numThreads = 0, size_t blockSize = ParallelGzWriter::DEFAULT_BLOCK_SIZE,
+                  int level = Z_DEFAULT_COMPRESSION)
+      : base_type(new ParallelGzWriter(filename, numThreads, blockSize, level), writeBuf, fmt, closeWriter) {}
+
+  ParSeqStreamOut(int fd, klibpp::format::Format fmt = base_type::DEFAULT_FORMAT,
+                  unsigned numThreads = 0, size_t blockSize = ParallelGzWriter::DEFAULT_BLOCK_SIZE,
+                  int level = Z_DEFAULT_COMPRESSION)
+      : base_type(new ParallelGzWriter(fd, numThreads, blockSize, level), writeBuf, fmt, closeWriter) {}
+
+  ParSeqStreamOut(ParallelGzWriter* writer, klibpp::format::Format fmt = base_type::DEFAULT_FORMAT)
+      : base_type(writer, writeBuf, fmt, closeWriter) {}
+
+  static int writeBuf(ParallelGzWriter* writer, const void* data, unsigned int len) {
+    return writer->write(data, len);
+  }
+
+  static int closeWriter(ParallelGzWriter* writer) {
+    int ret = writer->close();
+    delete writer;
+    return ret;
+  }
+};
+
+// ParallelGzWriter that also produces the random-access index of what it writes, so the output needs
+// no separate `main.out build` pass. Every gzip member start becomes an access point without a window
+// (members are independent), and callers report record starts through addRecord(). On close() the
+// index is saved next to the data as <filename>.index.gzip, in the format read by read_index().
+class IndexedGzWriter : public ParallelGzWriter {
+ public:
+  // Size of the gzip header deflate writes for windowBits 31; the raw deflate data starts after it
+  static constexpr uint64_t GZIP_HEADER_SIZE = 10;
+
+  IndexedGzWriter(const char* filename, unsigned numThreads = 0, size_t blockSize = DEFAULT_BLOCK_SIZE,
+                  int level = Z_DEFAULT_COMPRESSION)
+      : ParallelGzWriter(filename, numThreads, blockSize, level),
+        m_indexFileName(std::string(filename) + ".index.gzip") {}
+
+  IndexedGzWriter(const char* filename, const std::string& indexFileName, unsigned numThreads = 0,
+                  size_t blockSize = DEFAULT_BLOCK_SIZE, int level = Z_DEFAULT_COMPRESSION)
+      : ParallelGzWriter(filename, numThreads, blockSize, level), m_indexFileName(indexFileName) {}
+
+  ~IndexedGzWriter() override { close(); }
+
+  // Records must be added in file order, with the uncompressed offset of their first character
+  void addRecord(uint64_t offset) { m_recordBoundaries.push_back(offset); }
+
+  virtual int close() {
+    if (m_indexWritten) return ParallelGzWriter::close();
+    m_indexWritten = true;
+    if (ParallelGzWriter::close() != 0) return -1;
+    return saveIndex();
+  }
+
+  const std::string& indexFileName() const { return m_indexFileName; }
+
+ protected:
+  void onMember(uint64_t compressedOffset, uint64_t uncompressedOffset, const Block& block) override {
+    // An empty trailing member has nothing to point at, unless the whole file is empty
+    if (block.in.empty() && uncompressedOffset != 0) return;
+    point_t point;
+    point.out = uncompressedOffset;
+    point.in = compressedOffset + GZIP_HEADER_SIZE;
+    point.bits = 0;
+    point.dict = 0;
+    point.window = NULL;
+    m_points.push_back(point);
+  }
+
+ private:
+  std::string m_indexFileName;
+  std::vector<point_t> m_points;
+  std::vector<uint64_t> m_recordBoundaries;
+  bool m_indexWritten = false;
+
+  int saveIndex() {
+    struct deflate_index* index = (struct deflate_index*) malloc(sizeof(struct deflate_index));
+    if (index == NULL) return -1;
+    index->have = m_points.size();
+    index->mode = GZIP;
+    index->length = uncompressedBytes();
+    index->list = (point_t*) malloc(sizeof(point_t) * m_points.size());
+    if (index->list == NULL) {
+      free(index);
+      return -1;
+    }
+    std::copy(m_points.begin(), m_points.end(), index->list);
+    index->num_records = m_recordBoundaries.size();
+    index->record_boundaries = new vector<uint64_t>(m_recordBoundaries);
+    // End-of-data sentinel, the writer knows the exact length
+    index->record_boundaries->push_back(index->length);
+    index->summaries = NULL;
+    index->windows = NULL;
+    std::memset(&index->strm, 0, sizeof(index->strm));
+    inflateInit2(&index->strm, RAW);
+
+    int ret = -1;
+    gzFile out = gzopen(m_indexFileName.c_str(), "wb");
+    if (out != NULL) {
+      // deflate_index_save_gzip() closes the file
+      ret = deflate_index_save_gzip(out, index) == 0 ? 0 : -1;
+    }
+    delete index->record_boundaries;
+    deflate_index_free(index);
+    return ret;
+  }
+};
+
+// ParSeqStreamOut that writes <filename>.index.gzip along with the compressed records.
+class IndexedSeqStreamOut : public ParSeqStreamOut {
+ public:
+  IndexedSeqStreamOut(const char* filename, klibpp::format::Format fmt = base_type::DEFAULT_FORMAT,
+                      unsigned numThreads = 0, size_t blockSize = ParallelGzWriter::DEFAULT_BLOCK_SIZE,
+                      int level = Z_DEFAULT_COMPRESSION)
+      : ParSeqStreamOut(new IndexedGzWriter(filename, numThreads, blockSize, level), fmt) {}
+
+ protected:
+  // Called by KStreamOut::operator<< on the producing thread, so records written through a base class
+  // reference are indexed too
+  void on_record(unsigned long long int offset) override {
+    static_cast<IndexedGzWriter*>(this->f)->addRecord(offset);
+  }
+};
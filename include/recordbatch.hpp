@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "kseq++/kseq++.hpp"
+#include "recordchunk.hpp"
+#include "recordview.hpp"
+
+// Columnar batch of records: all names, all sequences and all qualities are each stored back to back in
+// one buffer, with offset arrays marking where record i starts (offsets hold size() + 1 entries). A
+// consumer can run a kernel over seqs or quals of the whole batch in one pass, e.g.
+// count_bases(batch.seqs.data(), batch.seqs.size(), counts), without touching per-record headers.
+// Offsets are 32-bit since a batch is filled from one extracted chunk, whose length is an int.
+// clear() keeps the capacity, so a pooled batch stops allocating once it has grown to its working size.
+struct RecordBatch {
+  std::vector<char> names;
+  std::vector<char> seqs;
+  std::vector<char> quals;  // empty for FASTA
+  std::vector<uint32_t> nameOffsets{0};
+  std::vector<uint32_t> seqOffsets{0};
+  std::vector<uint32_t> qualOffsets{0};
+  uint64_t firstRecord = 0;
+
+  size_t size() const { return seqOffsets.size() - 1; }
+
+  std::string_view name(size_t i) const { return field(names, nameOffsets, i); }
+  std::string_view seq(size_t i) const { return field(seqs, seqOffsets, i); }
+  std::string_view qual(size_t i) const { return field(quals, qualOffsets, i); }
+
+  void clear() {
+    names.clear();
+    seqs.clear();
+    quals.clear();
+    nameOffsets.resize(1);
+    seqOffsets.resize(1);
+    qualOffsets.resize(1);
+  }
+
+  // Copies the fields in the klibpp::field mask (comments are not stored); the others stay empty
+  void append(const RecordView& rec, unsigned fields = klibpp::field::all) {
+    if (fields & klibpp::field::name) names.insert(names.end(), rec.name.begin(), rec.name.end());
+    if (fields & klibpp::field::seq) seqs.insert(seqs.end(), rec.seq.begin(), rec.seq.end());
+    if (fields & klibpp::field::qual) quals.insert(quals.end(), rec.qual.begin(), rec.qual.end());
+    nameOffsets.push_back(names.size());
+    seqOffsets.push_back(seqs.size());
+    qualOffsets.push_back(quals.size());
+  }
+
+  // Replaces the contents with the records of an extracted buffer (writable, see RecordViewScanner)
+  size_t fill(char* buf, size_t len, unsigned fields = klibpp::field::all) {
+    return fill(buf, len, fields, [](const RecordView&) { return true; });
+  }
+
+  // Same, keeping only the records for which keep(rec) is true. Returns the number of records scanned
+  template <typename Keep>
+  size_t fill(char* buf, size_t len, unsigned fields, Keep&& keep) {
+    clear();
+    RecordViewScanner scanner(buf, len);
+    RecordView rec;
+    size_t scanned = 0;
+    while (scanner.next(rec)) {
+      ++scanned;
+      if (keep(rec)) append(rec, fields);
+    }
+    return scanned;
+  }
+
+ private:
+  static std::string_view field(const std::vector<char>& data, const std::vector<uint32_t>& offsets, size_t i) {
+    return std::string_view(data.data() + offsets[i], offsets[i + 1] - offsets[i]);
+  }
+};
+
+using RecordBatchPool = ChunkPool<RecordBatch>;
+using RecordBatchPtr = RecordBatchPool::Ptr;
@@ -0,0 +1,82 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "recordview.hpp"
+
+// Fixed set of reusable objects shared by producers and consumers. acquire() hands out a free object, or
+// creates one while fewer than capacity exist, and otherwise blocks until a consumer releases one; the
+// capacity therefore also bounds how far producers can run ahead of consumers.
+template <typename T>
+class ChunkPool {
+ public:
+  struct Releaser {
+    ChunkPool* pool;
+    void operator()(T* item) const { pool->release(item); }
+  };
+  using Ptr = std::unique_ptr<T, Releaser>;
+
+  ChunkPool(size_t capacity, std::function<T*()> make) : m_capacity(capacity), m_make(std::move(make)) {}
+
+  T* acquire() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_free.empty() && m_all.size() < m_capacity) {
+      m_all.emplace_back(m_make());
+      return m_all.back().get();
+    }
+    m_cv.wait(lock, [this]() { return !m_free.empty(); });
+    T* item = m_free.back();
+    m_free.pop_back();
+    return item;
+  }
+
+  void release(T* item) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_free.push_back(item);
+    }
+    m_cv.notify_one();
+  }
+
+  // Returns item to the pool when the handle goes out of scope
+  Ptr wrap(T* item) { return Ptr(item, Releaser{this}); }
+
+ private:
+  size_t m_capacity;
+  std::function<T*()> m_make;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::vector<std::unique_ptr<T>> m_all;
+  std::vector<T*> m_free;
+};
+
+// One extracted chunk. The decompressed bytes stay in the chunk's own buffer, which serves as the arena
+// for its records: RecordViewScanner compacts multi-line fields in place, and every RecordView points into
+// the buffer. Parsing a chunk therefore allocates nothing once the buffer and the records vector have
+// grown to their working size, and both are reused when the chunk goes back to the pool.
+struct RecordChunk {
+  std::unique_ptr<char[]> arena;
+  size_t capacity = 0;
+  size_t size = 0;  // bytes of arena in use
+  uint64_t firstRecord = 0;
+  std::vector<RecordView> records;
+
+  explicit RecordChunk(size_t bytes) : arena(new char[bytes]), capacity(bytes) {}
+
+  // Scans the size bytes in the arena into records; baseOffset is the file offset of the first byte
+  size_t parse(unsigned long long int baseOffset) {
+    records.clear();
+    RecordViewScanner scanner(arena.get(), size, baseOffset);
+    RecordView rec;
+    while (scanner.next(rec)) {
+      records.push_back(rec);
+    }
+    return records.size();
+  }
+};
+
+using RecordChunkPool = ChunkPool<RecordChunk>;
+using RecordChunkPtr = RecordChunkPool::Ptr;
@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "kseq++/kseq++.hpp"
+#include "parserstats.hpp"
+#include "recordview.hpp"
+#include "seqkernels.hpp"
+
+// Returns false for a record that should be dropped
+using RecordPredicate = std::function<bool(const RecordView&)>;
+
+inline RecordView viewOf(const klibpp::KSeq& rec) {
+  return RecordView{rec.name, rec.comment, rec.seq, rec.qual, rec.bytes_offset};
+}
+
+// Ordered list of named predicates, evaluated by the producer threads right after parsing. A record is kept
+// only if every predicate returns true, and is counted as rejected by the first one that fails, so later
+// filters only see the records that passed the earlier ones. Producers tally into a per-thread Tally and
+// flush it into the shared counters once per chunk.
+class RecordFilters {
+ public:
+  struct Tally {
+    std::vector<uint64_t> passed;
+    std::vector<uint64_t> rejected;
+  };
+
+  void add(const std::string& name, RecordPredicate keep) { m_filters.emplace_back(name, std::move(keep)); }
+  bool empty() const { return m_filters.empty(); }
+
+  Tally tally() const { return Tally{std::vector<uint64_t>(m_filters.size()), std::vector<uint64_t>(m_filters.size())}; }
+
+  bool keep(const RecordView& rec, Tally& tally) const {
+    for (size_t i = 0; i < m_filters.size(); ++i) {
+      if (!m_filters[i].keep(rec)) {
+        ++tally.rejected[i];
+        return false;
+      }
+      ++tally.passed[i];
+    }
+    return true;
+  }
+
+  void flush(Tally& tally) {
+    for (size_t i = 0; i < m_filters.size(); ++i) {
+      m_filters[i].passed.fetch_add(tally.passed[i], std::memory_order_relaxed);
+      m_filters[i].rejected.fetch_add(tally.rejected[i], std::memory_order_relaxed);
+      tally.passed[i] = 0;
+      tally.rejected[i] = 0;
+    }
+  }
+
+  std::vector<FilterStats> stats() const {
+    std::vector<FilterStats> s;
+    for (const Filter& f : m_filters) {
+      s.push_back(FilterStats{f.name, f.passed.load(std::memory_order_relaxed), f.rejected.load(std::memory_order_relaxed)});
+    }
+    return s;
+  }
+
+ private:
+  struct Filter {
+    std::string name;
+    RecordPredicate keep;
+    std::atomic<uint64_t> passed{0}, rejected{0};
+    Filter(const std::string& name, RecordPredicate keep) : name(name), keep(std::move(keep)) {}
+  };
+  std::deque<Filter> m_filters;  // a deque never moves its elements, which the atomics require
+};
+
+// Common predicates
+namespace recordfilter {
+
+inline RecordPredicate minLength(size_t minLen) {
+  return [minLen](const RecordView& rec) { return rec.seq.size() >= minLen; };
+}
+
+// Mean Phred score of at least minMean. Records without qualities (FASTA) pass
+inline RecordPredicate minMeanQuality(double minMean, int phredOffset = 33) {
+  return [minMean, phredOffset](const RecordView& rec) {
+    if (rec.qual.empty()) return true;
+    uint64_t sum = 0;
+    for (char q : rec.qual) sum += static_cast<unsigned char>(q);
+    return static_cast<double>(sum) / rec.qual.size() - phredOffset >= minMean;
+  };
+}
+
+// At most maxFraction of the bases are N (either case, as counted by count_bases())
+inline RecordPredicate maxNFraction(double maxFraction) {
+  return [maxFraction](const RecordView& rec) {
+    BaseCounts counts;
+    count_bases(rec.seq.data(), rec.seq.size(), counts);
+    return counts.N <= maxFraction * rec.seq.size();
+  };
+}
+
+}  // namespace recordfilter
@@ -0,0 +1,461 @@
+#pragma once
+// Long-running record server on a Unix domain socket. Keeps the index of every file it was asked about
+// loaded and the compressed file mapped, plus an LRU cache of decompressed blocks of records, so a query
+// costs a cache lookup (or one block extraction) instead of reloading the index.
+//
+// Protocol (host byte order, the socket is local): the client sends a RecordRequest followed by the fastq
+// path, the index path and, for RECORD_BY_NAME, the name; the server answers with a RecordResponse followed
+// by length payload bytes: the records as they appear in the file, or an error message if status != 0.
+// A connection may carry any number of requests.
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "recordview.hpp"
+#include "zran.hpp"
+
+enum RecordRequestType : uint32_t {
+  RECORD_RANGE = 1,    // records [a, a + b)
+  RECORD_BY_NAME = 2,  // every record whose name is the b name bytes following the paths
+  BYTE_RANGE = 3,      // uncompressed bytes [a, a + b)
+  SERVER_STOP = 4,     // no paths; the server exits once the response is sent
+};
+
+struct RecordRequest {
+  uint32_t magic = MAGIC;
+  uint32_t type = 0;
+  uint32_t fastqLen = 0;
+  uint32_t indexLen = 0;
+  uint64_t a = 0;
+  uint64_t b = 0;
+
+  static constexpr uint32_t MAGIC = 0x52534631;  // "RSF1"
+  static constexpr uint64_t MAX_FIELD_LEN = 1 << 16;  // bound on each of the paths and the name
+};
+
+struct RecordResponse {
+  int32_t status = 0;  // 0, or -1 with an error message as payload
+  uint32_t reserved = 0;
+  uint64_t length = 0;
+};
+
+namespace recordserver {
+
+inline bool readFully(int fd, void* buf, size_t len) {
+  char* p = static_cast<char*>(buf);
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+inline bool writeFully(int fd, const void* buf, size_t len) {
+  const char* p = static_cast<const char*>(buf);
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+inline bool socketAddress(const std::string& path, sockaddr_un& addr) {
+  if (path.size() >= sizeof(addr.sun_path)) return false;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+}  // namespace recordserver
+
+class RecordServer {
+ public:
+  // cacheBytes bounds the decompressed blocks kept in memory; a block holds blockRecords (> 0) records
+  RecordServer(size_t cacheBytes, uint64_t blockRecords) : m_cacheBytes(cacheBytes), m_blockRecords(blockRecords) {
+    assert(blockRecords > 0);
+  }
+  ~RecordServer() = default;
+
+  // Serves until a SERVER_STOP request arrives. Returns -1 if the socket cannot be set up.
+  int serve(const std::string& socketPath) {
+    sockaddr_un addr;
+    if (!recordserver::socketAddress(socketPath, addr)) {
+      fprintf(stderr, "Socket path too long: %s\n", socketPath.c_str());
+      return -1;
+    }
+    m_listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str());
+    if (m_listenFd < 0 || bind(m_listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(m_listenFd, 64) != 0) {
+      fprintf(stderr, "Could not listen on %s: %s\n", socketPath.c_str(), strerror(errno));
+      if (m_listenFd >= 0) close(m_listenFd);
+      return -1;
+    }
+
+    while (!m_stopping) {
+      int fd = accept(m_listenFd, NULL, NULL);
+      if (fd < 0) {
+        if (errno == EINTR) continue;
+        break;  // shut down by a stop request
+      }
+      {
+        std::lock_guard<std::mutex> lock(m_connectionsMutex);
+        m_connections.insert(fd);
+      }
+      std::thread([this, fd]() { handleConnection(fd); }).detach();
+    }
+    // Wake connections that are idle in read(), and wait until all of them have closed
+    {
+      std::unique_lock<std::mutex> lock(m_connectionsMutex);
+      for (int fd : m_connections) shutdown(fd, SHUT_RDWR);
+      m_connectionsClosed.wait(lock, [this]() { return m_connections.empty(); });
+    }
+    close(m_listenFd);
+    unlink(socketPath.c_str());
+    fprintf(stderr, "record server: %llu requests, %llu block hits, %llu block misses\n",
+            (unsigned long long) m_requests.load(), (unsigned long long) m_hits.load(),
+            (unsigned long long) m_misses.load());
+    return 0;
+  }
+
+ private:
+  struct ServedFile {
+    uint32_t id;
+    std::string fastq;
+    struct deflate_index* index = NULL;
+    gz_mapping_t mapping = {NULL, 0};
+    std::once_flag namesBuilt;
+    std::vector<std::pair<uint64_t, uint64_t>> names;  // (hash of the name, record index), sorted
+    // Idle extraction workspaces, one per concurrent extraction at most, reused across connections
+    std::mutex workspacesMutex;
+    std::vector<extract_workspace_t*> workspaces;
+
+    ~ServedFile() {
+      for (extract_workspace_t* ws : workspaces) extract_workspace_close(ws);
+      gz_mapping_close(&mapping);
+      if (index != NULL) deflate_index_free(index);
+    }
+  };
+
+  using Block = std::shared_ptr<const std::string>;
+  struct CacheEntry {
+    uint64_t key;
+    Block block;
+  };
+
+  size_t m_cacheBytes;
+  uint64_t m_blockRecords;
+  int m_listenFd = -1;
+  std::atomic<bool> m_stopping{false};
+  std::atomic<uint64_t> m_requests{0}, m_hits{0}, m_misses{0};
+
+  std::mutex m_filesMutex;
+  std::map<std::string, std::unique_ptr<ServedFile>> m_files;  // keyed by fastq path + '\0' + index path
+
+  std::mutex m_cacheMutex;
+  std::list<CacheEntry> m_lru;  // most recently used first
+  std::unordered_map<uint64_t, std::list<CacheEntry>::iterator> m_cache;
+  size_t m_cachedBytes = 0;
+
+  std::mutex m_connectionsMutex;
+  std::set<int> m_connections;
+  std::condition_variable m_connectionsClosed;
+
+  void handleConnection(int fd) {
+    RecordRequest req;
+    while (recordserver::readFully(fd, &req, sizeof(req))) {
+      if (req.magic != RecordRequest::MAGIC) break;
+      // Lengths come from the client: refuse oversized ones before allocating. The rest of the request is
+      // not read, so the connection cannot carry on
+      if (req.fastqLen > RecordRequest::MAX_FIELD_LEN || req.indexLen > RecordRequest::MAX_FIELD_LEN ||
+          (req.type == RECORD_BY_NAME && req.b > RecordRequest::MAX_FIELD_LEN)) {
+        std::string error = "request field too long";
+        RecordResponse resp;
+        resp.status = -1;
+        resp.length = error.size();
+        if (recordserver::writeFully(fd, &resp, sizeof(resp))) {
+          recordserver::writeFully(fd, error.data(), error.size());
+        }
+        break;
+      }
+      std::string fastq(req.fastqLen, '\0'), indexPath(req.indexLen, '\0'), name;
+      if (!recordserver::readFully(fd, &fastq[0], fastq.size()) ||
+          !recordserver::readFully(fd, &indexPath[0], indexPath.size())) {
+        break;
+      }
+      if (req.type == RECORD_BY_NAME) {
+        name.resize(req.b);
+        if (!recordserver::readFully(fd, &name[0], name.size())) break;
+      }
+      ++m_requests;
+
+      std::string payload;
+      int32_t status = 0;
+      if (req.type == SERVER_STOP) {
+        m_stopping = true;
+      } else {
+        status = answer(req, fastq, indexPath, name, payload);
+      }
+      RecordResponse resp;
+      resp.status = status;
+      resp.length = payload.size();
+      if (!recordserver::writeFully(fd, &resp, sizeof(resp)) ||
+          !recordserver::writeFully(fd, payload.data(), payload.size())) {
+        break;
+      }
+      if (req.type == SERVER_STOP) {
+        shutdown(m_listenFd, SHUT_RDWR);
+        break;
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_connectionsMutex);
+      close(fd);
+      m_connections.erase(fd);
+      // Notified under the lock: serve() may return as soon as it is released
+      m_connectionsClosed.notify_all();
+    }
+  }
+
+  int32_t answer(const RecordRequest& req, const std::string& fastq, const std::string& indexPath,
+                 const std::string& name, std::string& payload) {
+    ServedFile* file = openFile(fastq, indexPath, payload);
+    if (file == NULL) return -1;
+    const std::vector<uint64_t>& boundaries = *file->index->record_boundaries;
+    uint64_t numRecords = file->index->num_records;
+    bool ok = true;
+    if (req.type == RECORD_RANGE) {
+      uint64_t first = std::min(req.a, numRecords);
+      uint64_t last = std::min(numRecords, first + std::min(req.b, numRecords - first));
+      ok = appendBytes(file, boundaries[first], boundaries[last], payload);
+    } else if (req.type == BYTE_RANGE) {
+      uint64_t end = boundaries.back();
+      uint64_t from = std::min(req.a, end);
+      ok = appendBytes(file, from, from + std::min(req.b, end - from), payload);
+    } else if (req.type == RECORD_BY_NAME) {
+      ok = findByName(file, name, payload);
+    } else {
+      payload = "unknown request type";
+      return -1;
+    }
+    if (!ok) {
+      payload = "extraction failed";
+      return -1;
+    }
+    return 0;
+  }
+
+  ServedFile* openFile(const std::string& fastq, const std::string& indexPath, std::string& error) {
+    std::lock_guard<std::mutex> lock(m_filesMutex);
+    std::string key = fastq + '\0' + indexPath;
+    auto it = m_files.find(key);
+    if (it != m_files.end()) return it->second.get();
+
+    auto file = std::make_unique<ServedFile>();
+    file->id = m_files.size();
+    file->fastq = fastq;
+    if (deflate_index_load_lazy(indexPath.c_str(), &file->index) < 0) {
+      error = "could not load index " + indexPath;
+      return NULL;
+    }
+    // Without a mapping blocks are read through each workspace's FILE
+    gz_mapping_open(fastq.c_str(), &file->mapping);
+    ServedFile* served = file.get();
+    m_files.emplace(key, std::move(file));
+    return served;
+  }
+
+  // Appends the uncompressed bytes [from, to) of file, assembled from cached blocks. Bytes before the first
+  // record (the index need not start at 0) belong to no block and are left out
+  bool appendBytes(ServedFile* file, uint64_t from, uint64_t to, std::string& out) {
+    const std::vector<uint64_t>& boundaries = *file->index->record_boundaries;
+    from = std::max(from, boundaries.front());
+    while (from < to) {
+      uint64_t record = std::upper_bound(boundaries.begin(), boundaries.end(), from) - boundaries.begin() - 1;
+      uint64_t blockIdx = record / m_blockRecords;
+      Block block = getBlock(file, blockIdx);
+      if (block == nullptr) return false;
+      uint64_t blockStart = boundaries[blockIdx * m_blockRecords];
+      uint64_t blockEnd = blockStart + block->size();
+      uint64_t upTo = std::min(to, blockEnd);
+      // The end-of-data sentinel overestimates the length, so the last block ends before it
+      if (upTo <= from) break;
+      out.append(block->data() + (from - blockStart), upTo - from);
+      from = upTo;
+    }
+    return true;
+  }
+
+  Block getBlock(ServedFile* file, uint64_t blockIdx) {
+    uint64_t key = (static_cast<uint64_t>(file->id) << 40) | blockIdx;
+    {
+      std::lock_guard<std::mutex> lock(m_cacheMutex);
+      auto it = m_cache.find(key);
+      if (it != m_cache.end()) {
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+        ++m_hits;
+        return it->second->block;
+      }
+    }
+    ++m_misses;
+    // Extracted outside the lock; two connections missing on the same block both extract it
+    Block block = extractBlock(file, blockIdx);
+    if (block == nullptr) return nullptr;
+
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    if (m_cache.find(key) == m_cache.end()) {
+      m_lru.push_front({key, block});
+      m_cache[key] = m_lru.begin();
+      m_cachedBytes += block->size();
+      // A block still held by a connection stays alive until it is released
+      while (m_cachedBytes > m_cacheBytes && m_lru.size() > 1) {
+        m_cachedBytes -= m_lru.back().block->size();
+        m_cache.erase(m_lru.back().key);
+        m_lru.pop_back();
+      }
+    }
+    return block;
+  }
+
+  std::shared_ptr<std::string> extractBlock(ServedFile* file, uint64_t blockIdx) {
+    off_t first = blockIdx * m_blockRecords;
+    auto data = std::make_shared<std::string>(get_read_len(file->index, first, m_blockRecords), '\0');
+    // Each extraction needs its own inflate state, taken from the file's idle workspaces
+    extract_workspace_t* ws = NULL;
+    {
+      std::lock_guard<std::mutex> lock(file->workspacesMutex);
+      if (!file->workspaces.empty()) {
+        ws = file->workspaces.back();
+        file->workspaces.pop_back();
+      }
+    }
+    if (ws == NULL && (ws = extract_workspace_open(file->index, file->fastq.c_str(), &file->mapping)) == NULL) {
+      return nullptr;
+    }
+    unsigned char* buf = reinterpret_cast<unsigned char*>(&(*data)[0]);
+    int got;
+    std::tie(buf, got) = read_index(ws, first, m_blockRecords, buf);
+    {
+      std::lock_guard<std::mutex> lock(file->workspacesMutex);
+      file->workspaces.push_back(ws);
+    }
+    if (got < 0) return nullptr;
+    data->resize(got);
+    return data;
+  }
+
+  // The name table holds a 64-bit hash per record rather than the names, so candidates are checked
+  // against the extracted record. Built on the first lookup by walking the whole file once; a failed build
+  // throws out of call_once, which leaves the flag unset so the next lookup builds it again.
+  bool findByName(ServedFile* file, const std::string& name, std::string& out) {
+    try {
+      std::call_once(file->namesBuilt, [&]() {
+        if (!buildNames(file)) throw std::runtime_error("could not build the name table");
+      });
+    } catch (const std::runtime_error&) {
+      return false;
+    }
+    uint64_t h = std::hash<std::string_view>()(name);
+    auto range = std::equal_range(file->names.begin(), file->names.end(), std::make_pair(h, uint64_t(0)),
+                                  [](const std::pair<uint64_t, uint64_t>& x, const std::pair<uint64_t, uint64_t>& y) {
+                                    return x.first < y.first;
+                                  });
+    const std::vector<uint64_t>& boundaries = *file->index->record_boundaries;
+    for (auto it = range.first; it != range.second; ++it) {
+      std::string record;
+      if (!appendBytes(file, boundaries[it->second], boundaries[it->second + 1], record)) return false;
+      // Scan only the header line: the scanner compacts wrapped sequence lines in place
+      std::string header = record.substr(0, record.find('\n'));
+      RecordViewScanner scanner(&header[0], header.size());
+      RecordView rec;
+      if (scanner.next(rec) && rec.name == name) {
+        out.append(record);
+      }
+    }
+    return true;
+  }
+
+  bool buildNames(ServedFile* file) {
+    // Walked in blocks outside the cache, so building the table does not evict the hot blocks
+    uint64_t numRecords = file->index->num_records;
+    file->names.clear();
+    file->names.reserve(numRecords);
+    for (uint64_t blockIdx = 0; blockIdx * m_blockRecords < numRecords; ++blockIdx) {
+      std::shared_ptr<std::string> data = extractBlock(file, blockIdx);
+      if (data == nullptr) return false;
+      RecordViewScanner scanner(&(*data)[0], data->size());
+      RecordView rec;
+      uint64_t record = blockIdx * m_blockRecords;
+      while (scanner.next(rec)) {
+        file->names.emplace_back(std::hash<std::string_view>()(rec.name), record++);
+      }
+    }
+    std::sort(file->names.begin(), file->names.end());
+    return true;
+  }
+};
+
+// Client side of the protocol; one connection can send any number of requests
+class RecordClient {
+ public:
+  ~RecordClient() {
+    if (m_fd >= 0) close(m_fd);
+  }
+
+  bool connect(const std::string& socketPath) {
+    sockaddr_un addr;
+    if (!recordserver::socketAddress(socketPath, addr)) return false;
+    m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    return m_fd >= 0 && ::connect(m_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+  }
+
+  // Returns the response status (-1 with the message in payload), or -2 if the connection failed
+  int request(RecordRequestType type, const std::string& fastq, const std::string& indexPath, uint64_t a,
+              uint64_t b, const std::string& name, std::string& payload) {
+    RecordRequest req;
+    req.type = type;
+    req.fastqLen = fastq.size();
+    req.indexLen = indexPath.size();
+    req.a = a;
+    req.b = type == RECORD_BY_NAME ? name.size() : b;
+    std::string msg(reinterpret_cast<const char*>(&req), sizeof(req));
+    msg += fastq;
+    msg += indexPath;
+    if (type == RECORD_BY_NAME) msg += name;
+    RecordResponse resp;
+    if (!recordserver::writeFully(m_fd, msg.data(), msg.size()) ||
+        !recordserver::readFully(m_fd, &resp, sizeof(resp))) {
+      return -2;
+    }
+    payload.resize(resp.length);
+    if (!recordserver::readFully(m_fd, &payload[0], payload.size())) return -2;
+    return resp.status;
+  }
+
+ private:
+  int m_fd = -1;
+};
@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// A FASTA/FASTQ record whose fields point into a decompressed buffer instead of owning strings.
+struct RecordView {
+  std::string_view name;
+  std::string_view comment;
+  std::string_view seq;
+  std::string_view qual;
+  unsigned long long int bytes_offset;  // bytes offset from start of the file where this record starts
+};
+
+// Walks the records of a buffer extracted with read_index() without copying them. Follows the
+// same rules as KStream::operator>> (header up to the first blank, '+' ends the sequence, the
+// quality string is read until it is as long as the sequence). Sequence and quality lines of
+// wrapped records are compacted in place, which is why the buffer must be writable: every
+// field is contiguous, and single-line FASTQ is never moved.
+class RecordViewScanner {
+ public:
+  RecordViewScanner(char* buf, size_t len, unsigned long long int baseOffset = 0)
+      : m_buf(buf), m_len(len), m_pos(0), m_baseOffset(baseOffset), m_truncated(false) {}
+
+  bool next(RecordView& rec) {
+    // Jump to the next header line
+    while (m_pos < m_len && m_buf[m_pos] != '@' && m_buf[m_pos] != '>') {
+      m_pos = lineEnd(m_pos) + 1;
+    }
+    if (m_pos >= m_len) return false;
+
+    bool fastq = m_buf[m_pos] == '@';
+    rec.bytes_offset = m_baseOffset + m_pos;
+    size_t eol = lineEnd(m_pos);
+    size_t headerEnd = trimCR(m_pos + 1, eol);
+    size_t nameEnd = m_pos + 1;
+    while (nameEnd < headerEnd && m_buf[nameEnd] != ' ' && m_buf[nameEnd] != '\t') ++nameEnd;
+    rec.name = std::string_view(m_buf + m_pos + 1, nameEnd - m_pos - 1);
+    rec.comment = nameEnd < headerEnd ? std::string_view(m_buf + nameEnd + 1, headerEnd - nameEnd - 1)
+                                      : std::string_view();
+    m_pos = eol + 1;
+
+    size_t seqStart = m_pos;
+    size_t seqEnd = seqStart;
+    while (m_pos < m_len && m_buf[m_pos] != '+' && m_buf[m_pos] != '>' && m_buf[m_pos] != '@') {
+      seqEnd = appendLine(seqEnd);
+    }
+    rec.seq = std::string_view(m_buf + seqStart, seqEnd - seqStart);
+    rec.qual = std::string_view();
+    if (!fastq || m_pos >= m_len || m_buf[m_pos] != '+') return true;
+
+    m_pos = lineEnd(m_pos) + 1;  // skip the '+' line
+    size_t qualStart = m_pos;
+    size_t qualEnd = qualStart;
+    while (m_pos < m_len && qualEnd - qualStart < rec.seq.size()) {
+      qualEnd = appendLine(qualEnd);
+    }
+    rec.qual = std::string_view(m_buf + qualStart, qualEnd - qualStart);
+    if (rec.qual.size() != rec.seq.size()) m_truncated = true;
+    return true;
+  }
+
+  // True once a record whose quality length differs from its sequence length was returned
+  bool truncated() const { return m_truncated; }
+
+  size_t position() const { return m_pos; }
+
+ private:
+  char* m_buf;
+  size_t m_len;
+  size_t m_pos;
+  unsigned long long int m_baseOffset;
+  bool m_truncated;
+
+  size_t lineEnd(size_t from) const {
+    const char* nl = static_cast<const char*>(std::memchr(m_buf + from, '\n', m_len - from));
+    return nl != nullptr ? nl - m_buf : m_len;
+  }
+
+  size_t trimCR(size_t from, size_t to) const {
+    return to > from && m_buf[to - 1] == '\r' ? to - 1 : to;
+  }
+
+  // Moves the line at m_pos to dst (a no-op for the first line) and returns the new end of data
+  size_t appendLine(size_t dst) {
+    size_t eol = lineEnd(m_pos);
+    size_t end = trimCR(m_pos, eol);
+    size_t n = end - m_pos;
+    if (dst != m_pos) std::memmove(m_buf + dst, m_buf + m_pos, n);
+    m_pos = eol + 1;
+    return dst + n;
+  }
+};
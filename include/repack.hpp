@@ -0,0 +1,116 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "zran.hpp"
+#include "pgzwriter.hpp"
+
+// Recompress an indexed gzip FASTQ/FASTA file into concatenated gzip members that each start on a record
+// boundary and hold about blockBytes of uncompressed data (at least one record). Decompression runs on
+// numThreads threads using the existing index, compression on the IndexedGzWriter pool, and the new index
+// (<outFile>.index.gzip) has one window-free access point per member. Returns 0, or -1 on failure.
+int repack(const char *gzFile, struct deflate_index *index, const char *outFile, uint64_t blockBytes,
+           unsigned numThreads) {
+    const vector<uint64_t> &boundaries = *index->record_boundaries;
+    if (numThreads == 0)
+        numThreads = 1;
+
+    // Cut the records into groups of about blockBytes each. groups[g] is the first record of group g.
+    std::vector<off_t> groups;
+    uint64_t maxGroupLen = 0;
+    for (off_t r = 0; r < index->num_records;) {
+        off_t first = r;
+        groups.push_back(first);
+        do {
+            r++;
+        } while (r < index->num_records && boundaries[r] - boundaries[first] < blockBytes);
+        uint64_t groupLen = boundaries[r] - boundaries[first];
+        maxGroupLen = groupLen > maxGroupLen ? groupLen : maxGroupLen;
+    }
+    groups.push_back(index->num_records);
+    size_t numGroups = groups.size() - 1;
+
+    // The writer blocks must hold a whole group, so that it never cuts a member inside a record
+    IndexedGzWriter writer(outFile, numThreads, maxGroupLen > 0 ? maxGroupLen : 1);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<size_t, std::pair<unsigned char *, int>> ready;  // extracted groups waiting to be written
+    std::atomic<size_t> nextGroup{0};
+    size_t written = 0;
+    const size_t window = 2 * numThreads;  // bounds the number of extracted groups held in memory
+    bool failed = false;
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < numThreads; t++) {
+        workers.emplace_back([&]() {
+            // The groups' buffers are handed to the writer, so only the inflate state and file are reused
+            extract_workspace_t *ws = extract_workspace_open(index, gzFile);
+            while (true) {
+                size_t g = nextGroup.fetch_add(1);
+                if (g >= numGroups)
+                    break;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]() { return g < written + window || failed; });
+                    if (failed)
+                        break;
+                }
+                off_t n = groups[g + 1] - groups[g];
+                unsigned char *buf = ws != NULL ? (unsigned char *) malloc(get_read_len(index, groups[g], n)) : NULL;
+                int got = ws != NULL ? Z_MEM_ERROR : Z_ERRNO;
+                if (buf != NULL)
+                    std::tie(buf, got) = read_index(ws, groups[g], n, buf);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ready[g] = std::make_pair(buf, got);
+                }
+                cv.notify_all();
+            }
+            extract_workspace_close(ws);
+        });
+    }
+
+    // Append the groups in order; each one becomes its own member
+    for (size_t g = 0; g < numGroups && !failed; g++) {
+        std::pair<unsigned char *, int> group;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]() { return ready.count(g) != 0; });
+            group = ready[g];
+            ready.erase(g);
+        }
+        bool ok = group.second >= 0;
+        if (!ok) {
+            fprintf(stderr, "zran: extraction failed for records [%ld, %ld)\n", (long) groups[g], (long) groups[g + 1]);
+        } else {
+            // The output starts at the first record, so whatever preceded it in the input is not counted
+            for (off_t r = groups[g]; r < groups[g + 1]; r++)
+                writer.addRecord(boundaries[r] - boundaries[0]);
+            ok = writer.write(group.first, group.second) == group.second;
+            writer.endBlock();
+        }
+        free(group.first);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            written = g + 1;
+            failed = !ok;
+        }
+        cv.notify_all();
+    }
+
+    for (auto &t : workers)
+        t.join();
+    for (auto &entry : ready)
+        free(entry.second.first);
+    if (writer.close() != 0)
+        failed = true;
+    if (!failed)
+        fprintf(stderr, "zran: repacked %zu records into %zu members, index written to %s\n",
+                (size_t) index->num_records, numGroups, writer.indexFileName().c_str());
+    return failed ? -1 : 0;
+}
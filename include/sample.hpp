@@ -0,0 +1,154 @@
+#pragma once
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "zran.hpp"
+
+// numSelected distinct record indices out of numRecords, sorted, drawn uniformly with the given seed
+std::vector<off_t> sample_record_indices(off_t numRecords, off_t numSelected, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<off_t> selected;
+    numSelected = std::min(numSelected, numRecords);
+    selected.reserve(numSelected);
+    if (numSelected * 2 > numRecords) {
+        // Dense sample: one pass over all indices, keeping each with the remaining probability (Knuth's S)
+        for (off_t r = 0; r < numRecords && (off_t) selected.size() < numSelected; r++) {
+            off_t needed = numSelected - selected.size();
+            if (std::uniform_int_distribution<off_t>(0, numRecords - r - 1)(rng) < needed)
+                selected.push_back(r);
+        }
+        return selected;
+    }
+    // Sparse sample: Floyd's algorithm, O(numSelected) draws whatever the file size
+    std::unordered_set<off_t> chosen;
+    chosen.reserve(numSelected * 2);
+    for (off_t j = numRecords - numSelected; j < numRecords; j++) {
+        off_t t = std::uniform_int_distribution<off_t>(0, j)(rng);
+        chosen.insert(chosen.count(t) ? j : t);
+    }
+    selected.assign(chosen.begin(), chosen.end());
+    std::sort(selected.begin(), selected.end());
+    return selected;
+}
+
+// Writes the records at the sorted indices in selected to out, in file order. Records that share an access
+// point are extracted together, from the first to the last selected one, so only the spans holding a selected
+// record are inflated, on numThreads threads. Returns 0, or -1 on failure.
+int sample_records(const char *gzFile, struct deflate_index *index, const std::vector<off_t> &selected, FILE *out,
+                   unsigned numThreads) {
+    const vector<uint64_t> &boundaries = *index->record_boundaries;
+    if (numThreads == 0)
+        numThreads = 1;
+
+    // groups[g] is the position in selected of the first record of group g
+    std::vector<size_t> groups;
+    int lastPoint = -1;
+    for (size_t i = 0; i < selected.size(); i++) {
+        off_t offset = boundaries[selected[i]];
+        int lo = 0, hi = index->have;
+        while (hi - lo > 1) {
+            int mid = (lo + hi) >> 1;
+            if (offset < index->list[mid].out)
+                hi = mid;
+            else
+                lo = mid;
+        }
+        if (lo != lastPoint)
+            groups.push_back(i);
+        lastPoint = lo;
+    }
+    groups.push_back(selected.size());
+    size_t numGroups = groups.size() - 1;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<size_t, std::pair<unsigned char *, int>> ready;  // extracted groups waiting to be written
+    std::atomic<size_t> nextGroup{0};
+    std::atomic<uint64_t> inflated{0};
+    size_t written = 0;
+    const size_t window = 2 * numThreads;  // bounds the number of extracted groups held in memory
+    bool failed = false;
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < numThreads; t++) {
+        workers.emplace_back([&]() {
+            // The groups' buffers are handed to the writer, so only the inflate state and file are reused
+            extract_workspace_t *ws = extract_workspace_open(index, gzFile);
+            while (true) {
+                size_t g = nextGroup.fetch_add(1);
+                if (g >= numGroups)
+                    break;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]() { return g < written + window || failed; });
+                    if (failed)
+                        break;
+                }
+                off_t first = selected[groups[g]];
+                off_t last = selected[groups[g + 1] - 1];
+                unsigned char *buf = ws != NULL ? (unsigned char *) malloc(get_read_len(index, first, last - first + 1)) : NULL;
+                int got = ws != NULL ? Z_MEM_ERROR : Z_ERRNO;
+                if (buf != NULL) {
+                    extract_stats_t stats;
+                    std::tie(buf, got) = read_index(ws, first, last - first + 1, buf, &stats);
+                    inflated += stats.bytes_discarded + stats.bytes_inflated;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ready[g] = std::make_pair(buf, got);
+                }
+                cv.notify_all();
+            }
+            extract_workspace_close(ws);
+        });
+    }
+
+    // Write the selected records of each group, in order
+    for (size_t g = 0; g < numGroups && !failed; g++) {
+        std::pair<unsigned char *, int> group;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]() { return ready.count(g) != 0; });
+            group = ready[g];
+            ready.erase(g);
+        }
+        bool ok = group.second >= 0;
+        if (!ok) {
+            fprintf(stderr, "zran: extraction failed for record %ld\n", (long) selected[groups[g]]);
+        } else {
+            uint64_t base = boundaries[selected[groups[g]]];
+            for (size_t i = groups[g]; i < groups[g + 1] && ok; i++) {
+                // The end-of-data sentinel overestimates the last record, so clamp to what was extracted
+                uint64_t from = boundaries[selected[i]] - base;
+                uint64_t to = std::min<uint64_t>(boundaries[selected[i] + 1] - base, group.second);
+                ok = from >= to || fwrite(group.first + from, 1, to - from, out) == to - from;
+            }
+        }
+        free(group.first);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            written = g + 1;
+            failed = !ok;
+        }
+        cv.notify_all();
+    }
+
+    for (auto &t : workers)
+        t.join();
+    for (auto &entry : ready)
+        free(entry.second.first);
+    if (!failed)
+        fprintf(stderr, "zran: sampled %zu of %ld records from %zu of %d spans, inflated %.1f of %.1f MB\n",
+                selected.size(), (long) index->num_records, numGroups, index->have, inflated / 1e6,
+                index->length / 1e6);
+    return failed ? -1 : 0;
+}
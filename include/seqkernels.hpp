@@ -0,0 +1,390 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SEQKERNELS_X86 1
+#endif
+
+// Nucleotide composition of a buffer. A/C/G/T/N are counted in either case, so soft-masked
+// (lower case) bases count like the others, as in packed sequences; everything else (newlines,
+// the other IUPAC codes) is ignored.
+struct BaseCounts {
+  uint64_t A = 0, C = 0, G = 0, T = 0, N = 0;
+
+  inline uint64_t gc() const { return C + G; }
+  inline uint64_t total() const { return A + C + G + T + N; }
+  inline double gcContent() const {
+    uint64_t acgt = A + C + G + T;
+    return acgt == 0 ? 0.0 : static_cast<double>(gc()) / acgt;
+  }
+
+  inline BaseCounts& operator+=(const BaseCounts& other) {
+    A += other.A;
+    C += other.C;
+    G += other.G;
+    T += other.T;
+    N += other.N;
+    return *this;
+  }
+};
+
+namespace seqkernels {
+
+enum class Isa { Scalar, SSE42, AVX2, AVX512 };
+
+using CountFn = void (*)(const char*, size_t, BaseCounts&);
+// Position of the first byte outside an alphabet, or len if there is none
+using ScanFn = size_t (*)(const char*, size_t);
+
+inline const char* isa_name(Isa isa) {
+  switch (isa) {
+    case Isa::SSE42: return "sse4.2";
+    case Isa::AVX2: return "avx2";
+    case Isa::AVX512: return "avx512bw";
+    default: return "scalar";
+  }
+}
+
+struct BaseSlotTable {
+  uint8_t slot[256];
+  constexpr BaseSlotTable() : slot() {
+    for (int i = 0; i < 256; ++i) slot[i] = 5;
+    slot['A'] = 0;
+    slot['C'] = 1;
+    slot['G'] = 2;
+    slot['T'] = 3;
+    slot['N'] = 4;
+    slot['a'] = 0;
+    slot['c'] = 1;
+    slot['g'] = 2;
+    slot['t'] = 3;
+    slot['n'] = 4;
+  }
+};
+
+constexpr BaseSlotTable BASE_SLOTS;
+
+inline void count_bases_scalar(const char* seq, size_t len, BaseCounts& counts) {
+  uint64_t c[6] = {0, 0, 0, 0, 0, 0};
+  for (size_t i = 0; i < len; ++i) {
+    c[BASE_SLOTS.slot[static_cast<unsigned char>(seq[i])]]++;
+  }
+  counts.A += c[0];
+  counts.C += c[1];
+  counts.G += c[2];
+  counts.T += c[3];
+  counts.N += c[4];
+}
+
+// Bases: the IUPAC nucleotide codes (ACGTU, RYSWKM, BDHV, N) in either case. Qualities: Phred+33, '!' to '~'.
+// A byte from 0x40 to 0x7F is looked up by its low 5 bits, which are the same for both cases of a letter;
+// the SIMD kernels do the lookup with two 16-entry byte shuffles.
+struct IupacTable {
+  int8_t letter[32];
+  constexpr IupacTable() : letter() {
+    for (const char* p = "ACGTURYSWKMBDHVN"; *p != 0; ++p) letter[*p & 0x1F] = -1;
+  }
+};
+
+constexpr IupacTable IUPAC_LETTERS;
+
+inline bool is_valid_base(unsigned char c) { return (c & 0xC0) == 0x40 && IUPAC_LETTERS.letter[c & 0x1F] != 0; }
+
+inline bool is_valid_qual(unsigned char c) { return c >= '!' && c <= '~'; }
+
+inline size_t first_invalid_base_scalar(const char* s, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    if (!is_valid_base(static_cast<unsigned char>(s[i]))) return i;
+  }
+  return len;
+}
+
+inline size_t first_invalid_qual_scalar(const char* s, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    if (!is_valid_qual(static_cast<unsigned char>(s[i]))) return i;
+  }
+  return len;
+}
+
+#ifdef SEQKERNELS_X86
+// The count kernels set bit 0x20 of every byte and compare against lower case letters: that folds the
+// case of letters and maps no other byte onto one. The SSE and AVX2 kernels accumulate compare results
+// (0 or -1 per lane) into byte counters, and fold them into 64-bit totals with psadbw before any lane
+// can reach 255.
+__attribute__((target("sse4.2")))
+inline uint64_t hsum_epu8_sse(__m128i acc) {
+  __m128i sums = _mm_sad_epu8(acc, _mm_setzero_si128());
+  return static_cast<uint64_t>(_mm_cvtsi128_si64(sums)) +
+         static_cast<uint64_t>(_mm_extract_epi64(sums, 1));
+}
+
+__attribute__((target("sse4.2")))
+inline void count_bases_sse42(const char* seq, size_t len, BaseCounts& counts) {
+  const __m128i a = _mm_set1_epi8('a'), c = _mm_set1_epi8('c'), g = _mm_set1_epi8('g'),
+                t = _mm_set1_epi8('t'), n = _mm_set1_epi8('n'), fold = _mm_set1_epi8(0x20);
+  size_t i = 0;
+  while (i + 16 <= len) {
+    __m128i accA = _mm_setzero_si128(), accC = accA, accG = accA, accT = accA, accN = accA;
+    size_t blockEnd = i + 255 * 16 < len ? i + 255 * 16 : len;
+    for (; i + 16 <= blockEnd; i += 16) {
+      __m128i v = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(seq + i)), fold);
+      accA = _mm_sub_epi8(accA, _mm_cmpeq_epi8(v, a));
+      accC = _mm_sub_epi8(accC, _mm_cmpeq_epi8(v, c));
+      accG = _mm_sub_epi8(accG, _mm_cmpeq_epi8(v, g));
+      accT = _mm_sub_epi8(accT, _mm_cmpeq_epi8(v, t));
+      accN = _mm_sub_epi8(accN, _mm_cmpeq_epi8(v, n));
+    }
+    counts.A += hsum_epu8_sse(accA);
+    counts.C += hsum_epu8_sse(accC);
+    counts.G += hsum_epu8_sse(accG);
+    counts.T += hsum_epu8_sse(accT);
+    counts.N += hsum_epu8_sse(accN);
+  }
+  count_bases_scalar(seq + i, len - i, counts);
+}
+
+__attribute__((target("avx2")))
+inline uint64_t hsum_epu8_avx2(__m256i acc) {
+  __m256i sums = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+  return static_cast<uint64_t>(_mm256_extract_epi64(sums, 0)) +
+         static_cast<uint64_t>(_mm256_extract_epi64(sums, 1)) +
+         static_cast<uint64_t>(_mm256_extract_epi64(sums, 2)) +
+         static_cast<uint64_t>(_mm256_extract_epi64(sums, 3));
+}
+
+__attribute__((target("avx2")))
+inline void count_bases_avx2(const char* seq, size_t len, BaseCounts& counts) {
+  const __m256i a = _mm256_set1_epi8('a'), c = _mm256_set1_epi8('c'), g = _mm256_set1_epi8('g'),
+                t = _mm256_set1_epi8('t'), n = _mm256_set1_epi8('n'), fold = _mm256_set1_epi8(0x20);
+  size_t i = 0;
+  while (i + 32 <= len) {
+    __m256i accA = _mm256_setzero_si256(), accC = accA, accG = accA, accT = accA, accN = accA;
+    size_t blockEnd = i + 255 * 32 < len ? i + 255 * 32 : len;
+    for (; i + 32 <= blockEnd; i += 32) {
+      __m256i v = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(seq + i)), fold);
+      accA = _mm256_sub_epi8(accA, _mm256_cmpeq_epi8(v, a));
+      accC = _mm256_sub_epi8(accC, _mm256_cmpeq_epi8(v, c));
+      accG = _mm256_sub_epi8(accG, _mm256_cmpeq_epi8(v, g));
+      accT = _mm256_sub_epi8(accT, _mm256_cmpeq_epi8(v, t));
+      accN = _mm256_sub_epi8(accN, _mm256_cmpeq_epi8(v, n));
+    }
+    counts.A += hsum_epu8_avx2(accA);
+    counts.C += hsum_epu8_avx2(accC);
+    counts.G += hsum_epu8_avx2(accG);
+    counts.T += hsum_epu8_avx2(accT);
+    counts.N += hsum_epu8_avx2(accN);
+  }
+  // AVX2 implies SSE4.2; let the narrower kernel take the tail of short reads
+  count_bases_sse42(seq + i, len - i, counts);
+}
+
+// AVX-512BW compares straight into 64-bit masks, so a popcount per base is all that is left.
+__attribute__((target("avx512bw,bmi2,popcnt")))
+inline void count_bases_avx512(const char* seq, size_t len, BaseCounts& counts) {
+  const __m512i a = _mm512_set1_epi8('a'), c = _mm512_set1_epi8('c'), g = _mm512_set1_epi8('g'),
+                t = _mm512_set1_epi8('t'), n = _mm512_set1_epi8('n'), fold = _mm512_set1_epi8(0x20);
+  uint64_t cA = 0, cC = 0, cG = 0, cT = 0, cN = 0;
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m512i v = _mm512_or_si512(_mm512_loadu_si512(seq + i), fold);
+    cA += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v, a));
+    cC += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v, c));
+    cG += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v, g));
+    cT += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v, t));
+    cN += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v, n));
+  }
+  if (i < len) {
+    // Masked load for the tail; the zeroed lanes (0x20 once folded) never match a base
+    __mmask64 tail = _bzhi_u64(~0ULL, static_cast<unsigned>(len - i));
+    __m512i v = _mm512_or_si512(_mm512_maskz_loadu_epi8(tail, seq + i), fold);
+    cA += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v, a));
+    cC += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v, c));
+    cG += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v, g));
+    cT += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v, t));
+    cN += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v, n));
+  }
+  counts.A += cA;
+  counts.C += cC;
+  counts.G += cG;
+  counts.T += cT;
+  counts.N += cN;
+}
+
+// The validation scans build a mask of valid lanes per vector and stop at the first vector with a gap.
+// In the quality scans, the signed byte compares reject everything from 0x80 up along with the control characters.
+__attribute__((target("sse4.2")))
+inline size_t first_invalid_base_sse42(const char* s, size_t len) {
+  const __m128i lutLo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(IUPAC_LETTERS.letter));
+  const __m128i lutHi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(IUPAC_LETTERS.letter + 16));
+  const __m128i bit4 = _mm_set1_epi8(0x10), top = _mm_set1_epi8(static_cast<char>(0xC0)), letters = _mm_set1_epi8(0x40);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    __m128i known = _mm_blendv_epi8(_mm_shuffle_epi8(lutLo, v), _mm_shuffle_epi8(lutHi, v),
+                                    _mm_cmpeq_epi8(_mm_and_si128(v, bit4), bit4));
+    __m128i ok = _mm_and_si128(known, _mm_cmpeq_epi8(_mm_and_si128(v, top), letters));
+    unsigned bad = ~static_cast<unsigned>(_mm_movemask_epi8(ok)) & 0xFFFF;
+    if (bad != 0) return i + __builtin_ctz(bad);
+  }
+  return i + first_invalid_base_scalar(s + i, len - i);
+}
+
+__attribute__((target("sse4.2")))
+inline size_t first_invalid_qual_sse42(const char* s, size_t len) {
+  const __m128i lo = _mm_set1_epi8('!' - 1), hi = _mm_set1_epi8('~' + 1);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+    unsigned bad = ~static_cast<unsigned>(_mm_movemask_epi8(ok)) & 0xFFFF;
+    if (bad != 0) return i + __builtin_ctz(bad);
+  }
+  return i + first_invalid_qual_scalar(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+inline size_t first_invalid_base_avx2(const char* s, size_t len) {
+  // vpshufb looks up within each 128-bit lane, so both lanes carry the table
+  const __m256i lutLo = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(IUPAC_LETTERS.letter)));
+  const __m256i lutHi =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(IUPAC_LETTERS.letter + 16)));
+  const __m256i bit4 = _mm256_set1_epi8(0x10), top = _mm256_set1_epi8(static_cast<char>(0xC0)),
+                letters = _mm256_set1_epi8(0x40);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+    __m256i known = _mm256_blendv_epi8(_mm256_shuffle_epi8(lutLo, v), _mm256_shuffle_epi8(lutHi, v),
+                                       _mm256_cmpeq_epi8(_mm256_and_si256(v, bit4), bit4));
+    __m256i ok = _mm256_and_si256(known, _mm256_cmpeq_epi8(_mm256_and_si256(v, top), letters));
+    unsigned bad = ~static_cast<unsigned>(_mm256_movemask_epi8(ok));
+    if (bad != 0) return i + __builtin_ctz(bad);
+  }
+  return i + first_invalid_base_sse42(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+inline size_t first_invalid_qual_avx2(const char* s, size_t len) {
+  const __m256i lo = _mm256_set1_epi8('!' - 1), hi = _mm256_set1_epi8('~' + 1);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+    __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+    unsigned bad = ~static_cast<unsigned>(_mm256_movemask_epi8(ok));
+    if (bad != 0) return i + __builtin_ctz(bad);
+  }
+  return i + first_invalid_qual_sse42(s + i, len - i);
+}
+
+__attribute__((target("avx512bw,bmi2,popcnt")))
+inline size_t first_invalid_base_avx512(const char* s, size_t len) {
+  const __m512i lutLo = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_loadu_si128(reinterpret_cast<const __m128i*>(IUPAC_LETTERS.letter)));
+  const __m512i lutHi =
+      _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_loadu_si128(reinterpret_cast<const __m128i*>(IUPAC_LETTERS.letter + 16)));
+  const __m512i bit4 = _mm512_set1_epi8(0x10), top = _mm512_set1_epi8(static_cast<char>(0xC0)),
+                letters = _mm512_set1_epi8(0x40);
+  for (size_t i = 0; i < len; i += 64) {
+    __mmask64 lanes = len - i >= 64 ? ~0ULL : _bzhi_u64(~0ULL, static_cast<unsigned>(len - i));
+    __m512i v = _mm512_maskz_loadu_epi8(lanes, s + i);
+    __m512i known = _mm512_mask_blend_epi8(_mm512_test_epi8_mask(v, bit4), _mm512_shuffle_epi8(lutLo, v),
+                                           _mm512_shuffle_epi8(lutHi, v));
+    __mmask64 ok = _mm512_test_epi8_mask(known, known) & _mm512_cmpeq_epi8_mask(_mm512_and_si512(v, top), letters);
+    __mmask64 bad = ~ok & lanes;
+    if (bad != 0) return i + __builtin_ctzll(bad);
+  }
+  return len;
+}
+
+__attribute__((target("avx512bw,bmi2,popcnt")))
+inline size_t first_invalid_qual_avx512(const char* s, size_t len) {
+  const __m512i lo = _mm512_set1_epi8('!' - 1), hi = _mm512_set1_epi8('~' + 1);
+  for (size_t i = 0; i < len; i += 64) {
+    __mmask64 lanes = len - i >= 64 ? ~0ULL : _bzhi_u64(~0ULL, static_cast<unsigned>(len - i));
+    __m512i v = _mm512_maskz_loadu_epi8(lanes, s + i);
+    __mmask64 ok = _mm512_cmpgt_epi8_mask(v, lo) & _mm512_cmplt_epi8_mask(v, hi);
+    __mmask64 bad = ~ok & lanes;
+    if (bad != 0) return i + __builtin_ctzll(bad);
+  }
+  return len;
+}
+#endif
+
+inline bool isa_supported(Isa isa) {
+#ifdef SEQKERNELS_X86
+  __builtin_cpu_init();
+  switch (isa) {
+    case Isa::SSE42: return __builtin_cpu_supports("sse4.2");
+    case Isa::AVX2: return __builtin_cpu_supports("avx2");
+    case Isa::AVX512: return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("bmi2");
+    default: return true;
+  }
+#else
+  return isa == Isa::Scalar;
+#endif
+}
+
+inline CountFn count_fn(Isa isa) {
+#ifdef SEQKERNELS_X86
+  switch (isa) {
+    case Isa::SSE42: return count_bases_sse42;
+    case Isa::AVX2: return count_bases_avx2;
+    case Isa::AVX512: return count_bases_avx512;
+    default: break;
+  }
+#endif
+  return count_bases_scalar;
+}
+
+inline ScanFn base_scan_fn(Isa isa) {
+#ifdef SEQKERNELS_X86
+  switch (isa) {
+    case Isa::SSE42: return first_invalid_base_sse42;
+    case Isa::AVX2: return first_invalid_base_avx2;
+    case Isa::AVX512: return first_invalid_base_avx512;
+    default: break;
+  }
+#endif
+  return first_invalid_base_scalar;
+}
+
+inline ScanFn qual_scan_fn(Isa isa) {
+#ifdef SEQKERNELS_X86
+  switch (isa) {
+    case Isa::SSE42: return first_invalid_qual_sse42;
+    case Isa::AVX2: return first_invalid_qual_avx2;
+    case Isa::AVX512: return first_invalid_qual_avx512;
+    default: break;
+  }
+#endif
+  return first_invalid_qual_scalar;
+}
+
+inline Isa best_isa() {
+  for (Isa isa : {Isa::AVX512, Isa::AVX2, Isa::SSE42}) {
+    if (isa_supported(isa)) return isa;
+  }
+  return Isa::Scalar;
+}
+
+}  // namespace seqkernels
+
+// Adds the composition of seq[0, len) to counts using the widest kernel this CPU supports.
+// The kernel is picked once, on first use.
+inline void count_bases(const char* seq, size_t len, BaseCounts& counts) {
+  static const seqkernels::CountFn fn = seqkernels::count_fn(seqkernels::best_isa());
+  fn(seq, len, counts);
+}
+
+// Position of the first byte of seq[0, len) that is not an IUPAC nucleotide code (either case), or len
+inline size_t first_invalid_base(const char* seq, size_t len) {
+  static const seqkernels::ScanFn fn = seqkernels::base_scan_fn(seqkernels::best_isa());
+  return fn(seq, len);
+}
+
+// Position of the first byte of qual[0, len) outside Phred+33 '!'..'~', or len
+inline size_t first_invalid_qual(const char* qual, size_t len) {
+  static const seqkernels::ScanFn fn = seqkernels::qual_scan_fn(seqkernels::best_isa());
+  return fn(qual, len);
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Collects per-thread spans and writes them as Chrome trace-event JSON (chrome://tracing, Perfetto).
+// Every thread appends to its own buffer, so recording a span is a vector push_back with no locking;
+// only registering a thread takes the mutex. Timestamps are steady_clock nanoseconds, the clock used by
+// parserstats::nowNs() and extract_clock_ns().
+class Tracer {
+ public:
+  struct Event {
+    const char* name;  // must be a string literal
+    uint64_t start;
+    uint64_t end;
+    int64_t arg;       // e.g. the first record of a chunk, -1 for none
+  };
+
+  struct ThreadBuffer {
+    std::string name;
+    uint32_t tid;
+    std::vector<Event> events;
+
+    void span(const char* name, uint64_t start, uint64_t end, int64_t arg = -1) {
+      if (end > start) events.push_back({name, start, end, arg});
+    }
+  };
+
+  Tracer() : m_origin(now()) {}
+
+  static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // Returns a buffer owned by the tracer that stays valid until the tracer is destroyed
+  ThreadBuffer* registerThread(const std::string& name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_threads.emplace_back(new ThreadBuffer{name, static_cast<uint32_t>(m_threads.size() + 1), {}});
+    m_threads.back()->events.reserve(1024);
+    return m_threads.back().get();
+  }
+
+  // Must not be called while threads are still recording. Returns 0, or -1 if the file cannot be written.
+  int write(const std::string& path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ofstream out(path);
+    if (!out) return -1;
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (auto& t : m_threads) {
+      out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t->tid
+          << ", \"args\": {\"name\": \"" << t->name << "\"}}";
+      first = false;
+      for (const Event& e : t->events) {
+        // Chrome trace timestamps are microseconds
+        out << ",\n{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << t->tid
+            << ", \"ts\": " << (e.start - m_origin) / 1e3 << ", \"dur\": " << (e.end - e.start) / 1e3;
+        if (e.arg >= 0) out << ", \"args\": {\"chunk\": " << e.arg << "}";
+        out << "}";
+      }
+    }
+    out << "\n]}\n";
+    return out.good() ? 0 : -1;
+  }
+
+ private:
+  uint64_t m_origin;
+  std::mutex m_mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> m_threads;
+};
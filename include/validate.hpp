@@ -0,0 +1,137 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "seqkernels.hpp"
+
+// One malformed record: its index in the file, the uncompressed offset of the offending byte, and what is wrong
+struct FastqError {
+  uint64_t record;
+  uint64_t offset;
+  std::string message;
+};
+
+// Strict 4-line FASTQ check, run per chunk and merged like any mapReduce partial. Every record must be
+// '@name', a sequence of IUPAC nucleotide codes (either case), '+' optionally repeating the name, and a Phred+33 quality
+// of the same length; trailing '\r' is tolerated. Records are cut at the index's record boundaries, so a
+// broken record never shifts the check of the ones after it. Only the first maxErrors errors (by record
+// index) are kept, all of them are counted.
+struct FastqValidation {
+  uint64_t records = 0;
+  uint64_t bases = 0;
+  uint64_t errorCount = 0;
+  std::vector<FastqError> errors;
+  size_t maxErrors = 10;
+  // Uncompressed offset just past the last indexed record and any blank lines after it, 0 until it is checked.
+  // The bytes from there to the end of the file are the unindexed tail, which is not checked
+  uint64_t end = 0;
+
+  // Checks the records of an extracted chunk whose first record is firstRecord
+  void checkChunk(const char* buf, size_t len, uint64_t firstRecord, const std::vector<uint64_t>& boundaries) {
+    uint64_t base = boundaries[firstRecord];
+    for (uint64_t r = firstRecord; r + 1 < boundaries.size() && boundaries[r] - base < len; ++r) {
+      // The end-of-data sentinel overestimates the last record, so clamp to what was extracted
+      size_t from = boundaries[r] - base;
+      size_t to = std::min<uint64_t>(boundaries[r + 1] - base, len);
+      if (r + 2 == boundaries.size()) {
+        // The extract runs past the last indexed record into the unindexed tail, which is not this record's
+        to = from + recordLength(buf + from, to - from);
+        end = boundaries[r] + (to - from) + blankLines(buf + to, len - to);
+      }
+      checkRecord(buf + from, to - from, r, boundaries[r]);
+    }
+  }
+
+  // Checks one record held in rec[0, len), which starts at uncompressed offset offset. Returns true if valid
+  bool checkRecord(const char* rec, size_t len, uint64_t index, uint64_t offset) {
+    ++records;
+    const char* end = rec + len;
+    const char* p = rec;
+    const char* line[4];
+    size_t lineLen[4];
+    for (int i = 0; i < 4; ++i) {
+      if (p >= end) return fail(index, offset + (p - rec), "truncated record, " + std::to_string(i) + " of 4 lines");
+      const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+      const char* eol = nl != nullptr ? nl : end;
+      line[i] = p;
+      lineLen[i] = eol - p;
+      if (lineLen[i] > 0 && p[lineLen[i] - 1] == '\r') --lineLen[i];
+      p = nl != nullptr ? nl + 1 : end;
+    }
+    const uint64_t at[4] = {offset + (line[0] - rec), offset + (line[1] - rec), offset + (line[2] - rec),
+                            offset + (line[3] - rec)};
+
+    if (lineLen[0] == 0 || line[0][0] != '@') return fail(index, at[0], "header does not start with '@'");
+    if (lineLen[0] == 1 || line[0][1] == ' ' || line[0][1] == '\t') return fail(index, at[0] + 1, "empty read name");
+
+    size_t bad = first_invalid_base(line[1], lineLen[1]);
+    if (bad != lineLen[1]) return fail(index, at[1] + bad, "invalid base " + describe(line[1][bad]));
+    bases += lineLen[1];
+
+    if (lineLen[2] == 0 || line[2][0] != '+') return fail(index, at[2], "separator line does not start with '+'");
+    if (lineLen[2] > 1 && (lineLen[2] != lineLen[0] || memcmp(line[2] + 1, line[0] + 1, lineLen[0] - 1) != 0)) {
+      return fail(index, at[2] + 1, "separator line does not repeat the header");
+    }
+
+    if (lineLen[3] != lineLen[1]) {
+      return fail(index, at[3], "quality length " + std::to_string(lineLen[3]) + " differs from sequence length " +
+                                    std::to_string(lineLen[1]));
+    }
+    bad = first_invalid_qual(line[3], lineLen[3]);
+    if (bad != lineLen[3]) return fail(index, at[3] + bad, "invalid quality " + describe(line[3][bad]));
+
+    if (p != end) return fail(index, offset + (p - rec), "unexpected line after the quality line");
+    return true;
+  }
+
+  void merge(const FastqValidation& other) {
+    records += other.records;
+    bases += other.bases;
+    errorCount += other.errorCount;
+    errors.insert(errors.end(), other.errors.begin(), other.errors.end());
+    std::sort(errors.begin(), errors.end(),
+              [](const FastqError& a, const FastqError& b) { return a.record < b.record; });
+    if (errors.size() > maxErrors) errors.resize(maxErrors);
+    end = std::max(end, other.end);
+  }
+
+ private:
+  // Each partial sees its chunks in increasing order, so its first errors are the smallest record indices
+  bool fail(uint64_t index, uint64_t offset, std::string message) {
+    ++errorCount;
+    if (errors.size() < maxErrors) errors.push_back(FastqError{index, offset, std::move(message)});
+    return false;
+  }
+
+  // Bytes spanned by the first four lines of rec[0, len)
+  static size_t recordLength(const char* rec, size_t len) {
+    size_t at = 0;
+    for (int i = 0; i < 4 && at < len; ++i) {
+      const char* nl = static_cast<const char*>(memchr(rec + at, '\n', len - at));
+      at = nl != nullptr ? nl - rec + 1 : len;
+    }
+    return at;
+  }
+
+  // Bytes of blank lines at the start of text[0, len)
+  static size_t blankLines(const char* text, size_t len) {
+    size_t at = 0;
+    while (at < len && (text[at] == '\n' || text[at] == '\r')) ++at;
+    return at;
+  }
+
+  static std::string describe(char c) {
+    unsigned char u = static_cast<unsigned char>(c);
+    char text[16];
+    if (u >= 0x21 && u <= 0x7E) {
+      snprintf(text, sizeof(text), "'%c'", c);
+    } else {
+      snprintf(text, sizeof(text), "0x%02X", u);
+    }
+    return text;
+  }
+};
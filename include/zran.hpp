@@ -27,17 +27,28 @@
  * jloup@gzip.org          madler@alumni.caltech.edu
  */
 
+#pragma once
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <iostream>
 #include <stdexcept>
 #include <kseq++/seqio.hpp>
+#include "seqkernels.hpp"
 #include <limits>
 #include <utility>
 #include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 using namespace std;
 
@@ -50,6 +61,9 @@ using namespace std;
 
 #define SPAN 1048576L       // desired distance between access points
 #define LEN 10           // number of bytes to extract
+#define LEN_BINS 32         // read length histogram bins, bin b holds lengths in [2^b, 2^(b+1)), bin 0 also 0
+#define QUAL_BINS 64        // per-base quality histogram bins, Phred+33 scores capped at 63
+#define SUMMARY_MAGIC 0x4d4d5553U  // "SUMM", marks the optional summary section of an index file
 
 // Access point.
 typedef struct point {
@@ -60,6 +74,49 @@ typedef struct point {
     unsigned char *window;  // preceding 32K (or less) of uncompressed data
 } point_t;
 
+// Aggregates of the records starting between an access point and the next one.
+typedef struct span_summary {
+    uint64_t bases[5];                // A, C, G, T, N
+    uint64_t records;
+    uint64_t qual_sum;                // sum of the Phred scores of all bases with a quality
+    uint64_t qual_bases;              // number of bases with a quality
+    uint64_t length_hist[LEN_BINS];
+    uint64_t qual_hist[QUAL_BINS];
+} span_summary_t;
+
+// Byte counts and phase timestamps of one deflate_index_extract() call, filled in when the caller
+// passes a pointer. Timestamps are steady_clock nanoseconds; a phase that did not happen has zero length.
+typedef struct extract_stats {
+    uint64_t bytes_read;        // compressed bytes read from the file
+    uint64_t bytes_discarded;   // uncompressed bytes inflated before offset and thrown away
+    uint64_t bytes_inflated;    // uncompressed bytes inflated into buf
+    uint64_t t_start;           // seek to the access point
+    uint64_t t_seeked;          // reset the inflate engine and prime it with the bits and window
+    uint64_t t_primed;          // inflate and discard up to offset
+    uint64_t t_discarded;       // inflate into buf
+    uint64_t t_end;
+} extract_stats_t;
+
+static inline uint64_t extract_clock_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Windows of an index loaded with deflate_index_load_lazy(): read from the index file when an access point
+// is first used and kept in a bounded LRU. Shared by every copy of the index, hence the mutex.
+typedef std::shared_ptr<std::vector<unsigned char>> window_t;
+
+struct window_cache {
+    int fd;                      // the index file, read with pread()
+    std::vector<off_t> offsets;  // file offset of every access point's window
+    size_t capacity;             // windows kept in memory
+    std::mutex mutex;
+    std::list<std::pair<int, window_t>> lru;  // most recently used first
+    std::unordered_map<int, std::list<std::pair<int, window_t>>::iterator> cached;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
 // Access point list.
 struct deflate_index {
     int have;           // number of access points in list
@@ -69,6 +126,8 @@ struct deflate_index {
     z_stream strm;      // re-usable inflate engine for extraction
     vector <uint64_t> *record_boundaries; // stores bytes offsets of records in FASTQ file
     off_t num_records;  // number of records in FASTQ file
+    vector <span_summary_t> *summaries; // one per access point, or NULL if the index was built without them
+    struct window_cache *windows;       // NULL, or the windows are not in list[i].window but loaded on demand
 
     // Copy constructor - Shallow copy
     deflate_index(deflate_index &other) {
@@ -79,10 +138,45 @@ struct deflate_index {
         inflateCopy(&strm, &other.strm);
         record_boundaries = other.record_boundaries;
         num_records = other.num_records;
+        summaries = other.summaries;
+        windows = other.windows;
     }
 
 };
 
+// Window of access point i of a lazily loaded index, read from the index file if it is not cached.
+// Returns NULL on a read error.
+window_t deflate_index_window(struct deflate_index *index, int i) {
+    struct window_cache *cache = index->windows;
+    {
+        std::lock_guard<std::mutex> lock(cache->mutex);
+        auto it = cache->cached.find(i);
+        if (it != cache->cached.end()) {
+            cache->lru.splice(cache->lru.begin(), cache->lru, it->second);
+            cache->hits++;
+            return it->second->second;
+        }
+        cache->misses++;
+    }
+
+    // Read outside the lock; two threads missing on the same window both read it
+    unsigned dict = index->list[i].dict;
+    window_t window = std::make_shared<std::vector<unsigned char>>(dict);
+    if (pread(cache->fd, window->data(), dict, cache->offsets[i]) != (ssize_t) dict)
+        return NULL;
+
+    std::lock_guard<std::mutex> lock(cache->mutex);
+    if (cache->cached.find(i) == cache->cached.end()) {
+        cache->lru.emplace_front(i, window);
+        cache->cached[i] = cache->lru.begin();
+        while (cache->lru.size() > cache->capacity) {
+            cache->cached.erase(cache->lru.back().first);
+            cache->lru.pop_back();
+        }
+    }
+    return window;
+}
+
 void print_point(point_t *point) {
     // Print an entire access point in one line
     std::cout << "out: " << point->out << ", in: " << point->in << ", bits: " << point->bits << ", dict: "
@@ -125,6 +219,11 @@ void deflate_index_free(struct deflate_index *index) {
             free(index->list[--i].window);
         free(index->list);
         inflateEnd(&index->strm);
+        delete index->summaries;
+        if (index->windows != NULL) {
+            close(index->windows->fd);
+            delete index->windows;
+        }
         free(index);
     }
 }
@@ -145,8 +244,10 @@ int deflate_index_save(FILE *out, struct deflate_index *index) {
         if (fwrite(&point->out, sizeof(point->out), 1, out) != 1 ||
             fwrite(&point->in, sizeof(point->in), 1, out) != 1 ||
             fwrite(&point->bits, sizeof(point->bits), 1, out) != 1 ||
-            fwrite(&point->dict, sizeof(point->dict), 1, out) != 1 ||
-            fwrite(point->window, 1, point->dict, out) != point->dict)
+            fwrite(&point->dict, sizeof(point->dict), 1, out) != 1)
+            return Z_ERRNO;
+        window_t lazy = index->windows != NULL ? deflate_index_window(index, i) : NULL;
+        if (fwrite(lazy != NULL ? lazy->data() : point->window, 1, point->dict, out) != point->dict)
             return Z_ERRNO;
     }
 
@@ -155,6 +256,16 @@ int deflate_index_save(FILE *out, struct deflate_index *index) {
     if (fwrite(&boundaries_count, sizeof(boundaries_count), 1, out) != 1 ||
         fwrite(index->record_boundaries->data(), sizeof(uint64_t), boundaries_count, out) != boundaries_count)
         return Z_ERRNO;
+
+    // Write the optional span summaries
+    if (index->summaries != NULL) {
+        unsigned magic = SUMMARY_MAGIC;
+        size_t summaries_count = index->summaries->size();
+        if (fwrite(&magic, sizeof(magic), 1, out) != 1 ||
+            fwrite(&summaries_count, sizeof(summaries_count), 1, out) != 1 ||
+            fwrite(index->summaries->data(), sizeof(span_summary_t), summaries_count, out) != summaries_count)
+            return Z_ERRNO;
+    }
     auto end = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
     cout << "Time to save the index " << duration.count() << " milliseconds" << endl;
@@ -188,8 +299,10 @@ int deflate_index_save_gzip(gzFile out, struct deflate_index *index) {
         if (gzwrite(out, &point->out, sizeof(point->out)) != sizeof(point->out) ||
             gzwrite(out, &point->in, sizeof(point->in)) != sizeof(point->in) ||
             gzwrite(out, &point->bits, sizeof(point->bits)) != sizeof(point->bits) ||
-            gzwrite(out, &point->dict, sizeof(point->dict)) != sizeof(point->dict) ||
-            gzwrite(out, point->window, point->dict) != point->dict)
+            gzwrite(out, &point->dict, sizeof(point->dict)) != sizeof(point->dict))
+            return Z_ERRNO;
+        window_t lazy = index->windows != NULL ? deflate_index_window(index, i) : NULL;
+        if (gzwrite(out, lazy != NULL ? lazy->data() : point->window, point->dict) != point->dict)
             return Z_ERRNO;
     }
 
@@ -202,6 +315,18 @@ int deflate_index_save_gzip(gzFile out, struct deflate_index *index) {
         sizeof(uint64_t) * boundaries_count)
         return Z_ERRNO;
 
+    // Write the optional span summaries
+    if (index->summaries != NULL) {
+        unsigned magic = SUMMARY_MAGIC;
+        size_t summaries_count = index->summaries->size();
+        offset_size += sizeof(magic) + sizeof(summaries_count) + sizeof(span_summary_t) * summaries_count;
+        if (gzwrite(out, &magic, sizeof(magic)) != sizeof(magic) ||
+            gzwrite(out, &summaries_count, sizeof(summaries_count)) != sizeof(summaries_count) ||
+            gzwrite(out, index->summaries->data(), sizeof(span_summary_t) * summaries_count) !=
+            (int) (sizeof(span_summary_t) * summaries_count))
+            return Z_ERRNO;
+    }
+
     gzclose(out);
     auto end = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
@@ -217,6 +342,8 @@ int deflate_index_load(FILE *in, struct deflate_index **built) {
     struct deflate_index *index = (struct deflate_index *) malloc(sizeof(struct deflate_index));
     if (index == NULL)
         return Z_MEM_ERROR;
+    index->summaries = NULL;
+    index->windows = NULL;
 
     // Read metadata
     if (fread(&index->mode, sizeof(index->mode), 1, in) != 1 ||
@@ -244,7 +371,7 @@ int deflate_index_load(FILE *in, struct deflate_index **built) {
             return Z_ERRNO;
         }
         point->window = (unsigned char *) malloc(point->dict);
-        if (point->window == NULL) {
+        if (point->window == NULL && point->dict) {
             deflate_index_free(index);
             return Z_MEM_ERROR;
         }
@@ -267,6 +394,21 @@ int deflate_index_load(FILE *in, struct deflate_index **built) {
         return Z_ERRNO;
     }
 
+    // Read the span summaries, if the index has them
+    unsigned magic;
+    if (fread(&magic, sizeof(magic), 1, in) == 1 && magic == SUMMARY_MAGIC) {
+        size_t summaries_count;
+        if (fread(&summaries_count, sizeof(summaries_count), 1, in) != 1) {
+            deflate_index_free(index);
+            return Z_ERRNO;
+        }
+        index->summaries = new vector<span_summary_t>(summaries_count);
+        if (fread(index->summaries->data(), sizeof(span_summary_t), summaries_count, in) != summaries_count) {
+            deflate_index_free(index);
+            return Z_ERRNO;
+        }
+    }
+
     // Initialize inflation state
     index->strm.zalloc = Z_NULL;
     index->strm.zfree = Z_NULL;
@@ -281,13 +423,16 @@ int deflate_index_load(FILE *in, struct deflate_index **built) {
     return index->have;
 }
 
-// Read index from gzip file.
-int deflate_index_load_gzip(gzFile in, struct deflate_index **built) {
+// Read index from gzip file. With window_offsets, the windows are skipped instead of read and their offsets in
+// the file are stored there (only sensible for an uncompressed index, where skipping is a seek).
+int deflate_index_load_gzip_from(gzFile in, struct deflate_index **built, std::vector<off_t> *window_offsets) {
     auto start = std::chrono::high_resolution_clock::now();
 
     struct deflate_index *index = (struct deflate_index *) malloc(sizeof(struct deflate_index));
     if (index == NULL)
         return Z_MEM_ERROR;
+    index->summaries = NULL;
+    index->windows = NULL;
 
     // Read metadata
     if (gzread(in, &index->mode, sizeof(index->mode)) != sizeof(index->mode) ||
@@ -314,8 +459,18 @@ int deflate_index_load_gzip(gzFile in, struct deflate_index **built) {
             return Z_ERRNO;
         }
 
+        if (window_offsets != NULL) {
+            point->window = NULL;
+            window_offsets->push_back(gztell(in));
+            if (gzseek(in, point->dict, SEEK_CUR) < 0) {
+                index->have = i + 1;
+                deflate_index_free(index);
+                return Z_ERRNO;
+            }
+            continue;
+        }
         point->window = (unsigned char *) malloc(point->dict);
-        if (point->window == NULL) {
+        if (point->window == NULL && point->dict) {
             deflate_index_free(index);
             return Z_MEM_ERROR;
         }
@@ -338,6 +493,22 @@ int deflate_index_load_gzip(gzFile in, struct deflate_index **built) {
         return Z_ERRNO;
     }
 
+    // Read the span summaries, if the index has them
+    unsigned magic;
+    if (gzread(in, &magic, sizeof(magic)) == sizeof(magic) && magic == SUMMARY_MAGIC) {
+        size_t summaries_count;
+        if (gzread(in, &summaries_count, sizeof(summaries_count)) != sizeof(summaries_count)) {
+            deflate_index_free(index);
+            return Z_ERRNO;
+        }
+        index->summaries = new vector<span_summary_t>(summaries_count);
+        if (gzread(in, index->summaries->data(), sizeof(span_summary_t) * summaries_count) !=
+            (int) (sizeof(span_summary_t) * summaries_count)) {
+            deflate_index_free(index);
+            return Z_ERRNO;
+        }
+    }
+
     gzclose(in);
 
     // Initialize inflation state
@@ -354,6 +525,39 @@ int deflate_index_load_gzip(gzFile in, struct deflate_index **built) {
     return index->have;
 }
 
+int deflate_index_load_gzip(gzFile in, struct deflate_index **built) {
+    return deflate_index_load_gzip_from(in, built, NULL);
+}
+
+// Loads the index at index_file. An index saved uncompressed (build_index(..., plain = true)) is loaded
+// without its windows: only the access point table, the record boundaries and the summaries are read, and
+// each window is read from the file the first time an extraction starts at its access point, keeping at
+// most max_windows of them in memory. A gzip-compressed index cannot be seeked into and is loaded whole.
+int deflate_index_load_lazy(const char *index_file, struct deflate_index **built, size_t max_windows = 256) {
+    gzFile in = gzopen(index_file, "rb");
+    if (in == NULL)
+        return Z_ERRNO;
+    if (!gzdirect(in))
+        return deflate_index_load_gzip(in, built);
+
+    std::vector<off_t> offsets;
+    int have = deflate_index_load_gzip_from(in, built, &offsets);
+    if (have < 0)
+        return have;
+    int fd = open(index_file, O_RDONLY);
+    if (fd < 0) {
+        deflate_index_free(*built);
+        *built = NULL;
+        return Z_ERRNO;
+    }
+    struct window_cache *cache = new window_cache();
+    cache->fd = fd;
+    cache->offsets.swap(offsets);
+    cache->capacity = max_windows > 0 ? max_windows : 1;
+    (*built)->windows = cache;
+    return have;
+}
+
 // Add an access point to the list. If out of memory, deallocate the existing
 // list and return NULL. index->mode is temporarily the allocated number of
 // access points, until it is time for deflate_index_build() to return. Then
@@ -407,6 +611,9 @@ int deflate_index_build(FILE *in, off_t span, struct deflate_index **built) {
     struct deflate_index *index = (struct deflate_index *) malloc(sizeof(struct deflate_index));
     if (index == NULL)
         return Z_MEM_ERROR;
+    index->summaries = NULL;
+    index->windows = NULL;
+    index->record_boundaries = NULL;
     index->have = 0;
     index->mode = 0;            // entries in index->list allocation
     index->list = NULL;
@@ -517,10 +724,89 @@ int deflate_index_build(FILE *in, off_t span, struct deflate_index **built) {
     return index->have;
 }
 
+// Byte range [*start, *end) of the compressed file that deflate_index_extract() reads to get len
+// uncompressed bytes at offset. *end is 0 when the range runs to the end of the file. Returns 0, or -1
+// if the index cannot be used.
+int deflate_index_compressed_range(struct deflate_index *index, off_t offset, off_t len, off_t *start,
+                                   off_t *end) {
+    if (index == NULL || index->have < 1 || offset < 0 || len <= 0)
+        return -1;
+    // Access point closest to but not after offset, as in deflate_index_extract()
+    int lo = -1, hi = index->have;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) >> 1;
+        if (offset < index->list[mid].out)
+            hi = mid;
+        else
+            lo = mid;
+    }
+    point_t *point = index->list + lo;
+    // First access point at or after the end of the range
+    while (hi < index->have && index->list[hi].out < offset + len)
+        hi++;
+    *start = point->in - (point->bits ? 1 : 0);
+    // Inflate reads input CHUNK bytes at a time, so it may read a little past the next access point
+    *end = hi < index->have ? index->list[hi].in + CHUNK : 0;
+    return 0;
+}
+
 #define INFLATEPRIME inflatePrime
 
-ptrdiff_t deflate_index_extract(FILE *in, struct deflate_index *index,
-                                off_t offset, unsigned char *buf, size_t len) {
+// Compressed input for deflate_index_extract_from(): seek() positions the source, getbyte() returns
+// the next byte or EOF, fill() points strm->next_in at more input and returns how much (-1 on a read
+// error), more() tells whether any input is left, error() whether reading failed.
+
+// Reads a FILE in CHUNK-sized pieces through a caller-owned buffer of CHUNK bytes
+struct file_source {
+    FILE *in;
+    unsigned char *input;
+
+    file_source(FILE *file, unsigned char *buffer) : in(file), input(buffer) {}
+    int seek(off_t pos) { return fseeko(in, pos, SEEK_SET); }
+    int getbyte() { return getc(in); }
+    int fill(z_stream *strm) {
+        strm->avail_in = fread(input, 1, CHUNK, in);
+        strm->next_in = input;
+        return strm->avail_in < CHUNK && ferror(in) ? -1 : (int) strm->avail_in;
+    }
+    bool more() { return ungetc(getc(in), in) != EOF; }
+    bool error() { return ferror(in) != 0; }
+};
+
+// Hands out slices of an in-memory (usually mmap()ed) file directly, without copying
+#define MEM_SLICE (1U << 20)    // input given to inflate at a time, keeps bytes_read close to what is used
+struct mem_source {
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+
+    mem_source(const unsigned char *d, size_t n) : data(d), size(n), pos(0) {}
+    int seek(off_t p) {
+        if (p < 0 || (size_t) p > size)
+            return -1;
+        pos = p;
+        return 0;
+    }
+    int getbyte() { return pos < size ? data[pos++] : EOF; }
+    int fill(z_stream *strm) {
+        size_t n = size - pos < MEM_SLICE ? size - pos : MEM_SLICE;
+        strm->next_in = (z_const Bytef *) (data + pos);
+        strm->avail_in = (unsigned) n;
+        pos += n;
+        return (int) n;
+    }
+    bool more() { return pos < size; }
+    bool error() { return false; }
+};
+
+// discard receives the WINSIZE-sized pieces inflated before offset
+template <typename Source>
+ptrdiff_t deflate_index_extract_from(Source &in, struct deflate_index *index,
+                                     off_t offset, unsigned char *buf, size_t len,
+                                     extract_stats_t *stats, unsigned char *discard) {
+    if (stats != NULL)
+        memset(stats, 0, sizeof(extract_stats_t));
+
     // Do a quick sanity check on the index.
     if (index == NULL || index->have < 1 || index->list[0].out != 0) {
         std::cout << "zran: index is not ready" << std::endl;
@@ -546,14 +832,18 @@ ptrdiff_t deflate_index_extract(FILE *in, struct deflate_index *index,
     point += lo;
 
     // Initialize the input file and prime the inflate engine to start there.
-    int ret = fseeko(in, point->in - (point->bits ? 1 : 0), SEEK_SET);
+    uint64_t t_start = stats != NULL ? extract_clock_ns() : 0;
+    int ret = in.seek(point->in - (point->bits ? 1 : 0));
     if (ret == -1) {
         std::cout << "zran: seek error" << std::endl;
         return Z_ERRNO;
     }
     int ch = 0;
-    if (point->bits && (ch = getc(in)) == EOF)
-        return ferror(in) ? Z_ERRNO : Z_BUF_ERROR;
+    if (point->bits && (ch = in.getbyte()) == EOF)
+        return in.error() ? Z_ERRNO : Z_BUF_ERROR;
+    extract_stats_t counts = {point->bits ? 1U : 0U, 0, 0, t_start, 0, 0, 0, 0};
+    if (stats != NULL)
+        counts.t_seeked = extract_clock_ns();
     index->strm.avail_in = 0;
     ret = inflateReset2(&index->strm, RAW);
     if (ret != Z_OK) {
@@ -562,11 +852,17 @@ ptrdiff_t deflate_index_extract(FILE *in, struct deflate_index *index,
     }
     if (point->bits)
         INFLATEPRIME(&index->strm, point->bits, ch >> (8 - point->bits));
-    inflateSetDictionary(&index->strm, point->window, point->dict);
+    if (index->windows != NULL) {
+        window_t window = deflate_index_window(index, point - index->list);
+        if (window == NULL)
+            return Z_ERRNO;
+        inflateSetDictionary(&index->strm, window->data(), point->dict);
+    } else
+        inflateSetDictionary(&index->strm, point->window, point->dict);
+    if (stats != NULL)
+        counts.t_primed = counts.t_discarded = extract_clock_ns();
 
     // Skip uncompressed bytes until offset reached, then satisfy request.
-    unsigned char input[CHUNK];
-    unsigned char discard[WINSIZE];
     offset -= point->out;       // number of bytes to skip to get to offset
     size_t left = len;          // number of bytes left to read after offset
     do {
@@ -585,22 +881,25 @@ ptrdiff_t deflate_index_extract(FILE *in, struct deflate_index *index,
         // Uncompress, setting got to the number of bytes uncompressed.
         if (index->strm.avail_in == 0) {
             // Assure available input.
-            index->strm.avail_in = fread(input, 1, CHUNK, in);
-            if (index->strm.avail_in < CHUNK && ferror(in)) {
+            if (in.fill(&index->strm) < 0) {
                 ret = Z_ERRNO;
                 break;
             }
-            index->strm.next_in = input;
+            counts.bytes_read += index->strm.avail_in;
         }
         unsigned got = index->strm.avail_out;
         ret = inflate(&index->strm, Z_NO_FLUSH);
         got -= index->strm.avail_out;
 
         // Update the appropriate count.
-        if (offset)
+        if (offset) {
             offset -= got;
-        else {
+            counts.bytes_discarded += got;
+            if (offset == 0 && stats != NULL)
+                counts.t_discarded = extract_clock_ns();
+        } else {
             left -= got;
+            counts.bytes_inflated += got;
             if (left == 0)
                 // Request satisfied.
                 break;
@@ -619,26 +918,26 @@ ptrdiff_t deflate_index_extract(FILE *in, struct deflate_index *index,
                 drop -= index->strm.avail_in;
                 index->strm.avail_in = 0;
                 do {
-                    if (getc(in) == EOF) {
+                    counts.bytes_read++;
+                    if (in.getbyte() == EOF) {
                         // The input does not have a complete trailer.
                         std::cout << "zran: unexpected EOF" << std::endl;
-                        return ferror(in) ? Z_ERRNO : Z_BUF_ERROR;
+                        return in.error() ? Z_ERRNO : Z_BUF_ERROR;
                     }
                 } while (--drop);
             }
 
-            if (index->strm.avail_in || ungetc(getc(in), in) != EOF) {
+            if (index->strm.avail_in || in.more()) {
                 // There's more after the gzip trailer. Use inflate to skip the
                 // gzip header and resume the raw inflate there.
                 inflateReset2(&index->strm, GZIP);
                 do {
                     if (index->strm.avail_in == 0) {
-                        index->strm.avail_in = fread(input, 1, CHUNK, in);
-                        if (index->strm.avail_in < CHUNK && ferror(in)) {
+                        if (in.fill(&index->strm) < 0) {
                             ret = Z_ERRNO;
                             break;
                         }
-                        index->strm.next_in = input;
+                        counts.bytes_read += index->strm.avail_in;
                     }
                     index->strm.avail_out = WINSIZE;
                     index->strm.next_out = discard;
@@ -656,6 +955,10 @@ ptrdiff_t deflate_index_extract(FILE *in, struct deflate_index *index,
 
     // Return the number of uncompressed bytes read into buf, or the error.
     // return ret == Z_OK || ret == Z_STREAM_END ? len - left : ret;
+    if (stats != NULL) {
+        counts.t_end = extract_clock_ns();
+        *stats = counts;
+    }
 
     if (ret == Z_OK || ret == Z_STREAM_END) {
         return len - left;
@@ -666,8 +969,64 @@ ptrdiff_t deflate_index_extract(FILE *in, struct deflate_index *index,
 
 }
 
+ptrdiff_t deflate_index_extract(FILE *in, struct deflate_index *index,
+                                off_t offset, unsigned char *buf, size_t len,
+                                extract_stats_t *stats = NULL) {
+    unsigned char input[CHUNK];
+    unsigned char discard[WINSIZE];
+    file_source src(in, input);
+    return deflate_index_extract_from(src, index, offset, buf, len, stats, discard);
+}
 
-void build_index(const char *gzFile1, off_t span) {
+// Add one record to a span summary.
+void span_summary_add(span_summary_t *summary, const klibpp::KSeq &record) {
+    BaseCounts counts;
+    count_bases(record.seq.data(), record.seq.size(), counts);
+    summary->bases[0] += counts.A;
+    summary->bases[1] += counts.C;
+    summary->bases[2] += counts.G;
+    summary->bases[3] += counts.T;
+    summary->bases[4] += counts.N;
+    summary->records++;
+
+    size_t length = record.seq.size();
+    int bin = length == 0 ? 0 : 63 - __builtin_clzll(length);
+    summary->length_hist[bin < LEN_BINS ? bin : LEN_BINS - 1]++;
+
+    for (char q : record.qual) {
+        int score = q - 33;
+        score = score < 0 ? 0 : score >= QUAL_BINS ? QUAL_BINS - 1 : score;
+        summary->qual_hist[score]++;
+        summary->qual_sum += score;
+    }
+    summary->qual_bases += record.qual.size();
+}
+
+// Add the summaries of access point intervals [first, last) into *out, which is not cleared first.
+// Whole-file or range aggregates are answered from the index alone, at access point granularity.
+// Returns Z_STREAM_ERROR if the index was built without summaries or the range is invalid.
+int deflate_index_summarize(struct deflate_index *index, int first, int last, span_summary_t *out) {
+    if (index->summaries == NULL || first < 0 || last > (int) index->summaries->size() || first > last)
+        return Z_STREAM_ERROR;
+    for (int p = first; p < last; p++) {
+        const span_summary_t &summary = (*index->summaries)[p];
+        for (int b = 0; b < 5; b++)
+            out->bases[b] += summary.bases[b];
+        out->records += summary.records;
+        out->qual_sum += summary.qual_sum;
+        out->qual_bases += summary.qual_bases;
+        for (int b = 0; b < LEN_BINS; b++)
+            out->length_hist[b] += summary.length_hist[b];
+        for (int b = 0; b < QUAL_BINS; b++)
+            out->qual_hist[b] += summary.qual_hist[b];
+    }
+    return Z_OK;
+}
+
+// Writes the index to index_file, or to <gzFile1>.index.gzip when it is NULL. A plain index is written
+// uncompressed: every loader still reads it, and deflate_index_load_lazy() can leave its windows on disk.
+void build_index(const char *gzFile1, off_t span, bool with_summaries = false, const char *index_file = NULL,
+                 bool plain = false) {
     FILE *in = fopen(gzFile1, "rb");
     if (in == NULL) {
         throw runtime_error("Could not open the given gzFile1 for reading");
@@ -704,10 +1063,19 @@ void build_index(const char *gzFile1, off_t span) {
     klibpp::SeqStreamIn iss(gzFile1);
     uint64_t RECORD_SPAN = 10000;
     index->record_boundaries = new vector<uint64_t>();
+    if (with_summaries)
+        index->summaries = new vector<span_summary_t>(index->have, span_summary_t{});
+    int point = 0;
     while (iss >> record) {
         //if (count++ % RECORD_SPAN == 0) {
         index->record_boundaries->push_back(record.bytes_offset);
         //}
+        if (with_summaries) {
+            // Records come in file order, so the access point interval only moves forward
+            while (point + 1 < index->have && index->list[point + 1].out <= (off_t) record.bytes_offset)
+                point++;
+            span_summary_add(&(*index->summaries)[point], record);
+        }
     }
     index->num_records = index->record_boundaries->size();
     // Adding 1000 as a buffer because kseqc++ removes some characters while parsing the records.
@@ -728,8 +1096,13 @@ void build_index(const char *gzFile1, off_t span) {
     strcpy(filename, gzFile1);
     strcat(filename, ".index");
 
-    strcpy(filename_gzip, gzFile1);
-    strcat(filename_gzip, ".index.gzip");
+    if (index_file != NULL) {
+        free(filename_gzip);
+        filename_gzip = strdup(index_file);
+    } else {
+        strcpy(filename_gzip, gzFile1);
+        strcat(filename_gzip, ".index.gzip");
+    }
 
     fprintf(stderr, "zran: attempting to write index to %s\n", filename_gzip);
 
@@ -742,7 +1115,7 @@ void build_index(const char *gzFile1, off_t span) {
 //        return;
 //    }
 
-    gzFile idx_gzip = gzopen(filename_gzip, "wb");
+    gzFile idx_gzip = gzopen(filename_gzip, plain ? "wbT" : "wb");
 
     // Write the index to the file.
 //    len = deflate_index_save(idx, index);
@@ -760,14 +1133,17 @@ void build_index(const char *gzFile1, off_t span) {
     // Clean up and exit
 //    fclose(idx);
     free(filename);
+    free(filename_gzip);
     deflate_index_free(index);
     fclose(in);
     return;
 }
 
 off_t get_read_len(struct deflate_index *index, off_t record_idx, off_t num_records) {
-    if (record_idx >= (index->record_boundaries->size() - num_records)) {
-        num_records = index->record_boundaries->size() - record_idx - 1;
+    // The last boundary is the end-of-data sentinel, so at most size - 1 - record_idx records remain
+    off_t available = (off_t) index->record_boundaries->size() - 1 - record_idx;
+    if (num_records > available) {
+        num_records = available;
     }
     off_t read_len = (*index->record_boundaries)[record_idx + num_records] - (*index->record_boundaries)[record_idx];
     return read_len;
@@ -776,7 +1152,7 @@ off_t get_read_len(struct deflate_index *index, off_t record_idx, off_t num_reco
 // TODO: This should be named something else like read_records
 std::pair<unsigned char *, int>
 read_index(const char *gzFile, struct deflate_index *index, off_t record_idx, off_t num_records,
-           unsigned char *buf = NULL) {
+           unsigned char *buf = NULL, extract_stats_t *stats = NULL) {
     FILE *in = fopen(gzFile, "rb");
     if (in == NULL) {
         throw runtime_error("Could not open the given gzFile for reading");
@@ -785,8 +1161,10 @@ read_index(const char *gzFile, struct deflate_index *index, off_t record_idx, of
     //fprintf(stderr, "Extracting %d record\n", record_idx);
 
 
-    if (record_idx >= (index->record_boundaries->size() - num_records)) {
-        num_records = index->record_boundaries->size() - record_idx - 1;
+    // The last boundary is the end-of-data sentinel, so at most size - 1 - record_idx records remain
+    off_t available = (off_t) index->record_boundaries->size() - 1 - record_idx;
+    if (num_records > available) {
+        num_records = available;
     }
     off_t offset = (*index->record_boundaries)[record_idx];
     off_t read_len = (*index->record_boundaries)[record_idx + num_records] - (*index->record_boundaries)[record_idx];
@@ -795,7 +1173,7 @@ read_index(const char *gzFile, struct deflate_index *index, off_t record_idx, of
     if (buf == NULL) {
         buf = (unsigned char *) malloc(read_len);
     }
-    ptrdiff_t got = deflate_index_extract(in, index, offset, buf, read_len);
+    ptrdiff_t got = deflate_index_extract(in, index, offset, buf, read_len, stats);
 
     //if (got < 0)
     //    fprintf(stderr, "zran: extraction failed: %s error\n",
@@ -808,6 +1186,132 @@ read_index(const char *gzFile, struct deflate_index *index, off_t record_idx, of
     return std::make_pair(buf, got);
 }
 
+// A compressed file mapped into memory once, so that any number of threads can extract from it
+// without a FILE, a read buffer or a system call per CHUNK.
+typedef struct gz_mapping {
+    const unsigned char *data;
+    size_t size;
+} gz_mapping_t;
+
+// Returns 0, or -1 if the file cannot be opened or mapped
+int gz_mapping_open(const char *gzFile, gz_mapping_t *map) {
+    map->data = NULL;
+    map->size = 0;
+    int fd = open(gzFile, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // the mapping keeps the file referenced
+    if (data == MAP_FAILED)
+        return -1;
+    map->data = (const unsigned char *) data;
+    map->size = st.st_size;
+    return 0;
+}
+
+void gz_mapping_close(gz_mapping_t *map) {
+    if (map->data != NULL)
+        munmap((void *) map->data, map->size);
+    map->data = NULL;
+    map->size = 0;
+}
+
+// Marks the compressed range holding uncompressed [offset, offset + len) MADV_SEQUENTIAL, so the kernel
+// reads it ahead and can drop it behind.
+void gz_mapping_advise(const gz_mapping_t *map, struct deflate_index *index, off_t offset, off_t len) {
+    off_t start, end;
+    if (deflate_index_compressed_range(index, offset, len, &start, &end) == 0) {
+        size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        size_t first = (size_t) start & ~(page - 1);
+        size_t last = end == 0 || (size_t) end > map->size ? map->size : (size_t) end;
+        madvise((void *) (map->data + first), last - first, MADV_SEQUENTIAL);
+    }
+}
+
+// Everything one thread needs to extract over and over, set up once: its own inflate engine (a copy of the
+// index, sharing the access points), the compressed file kept open (or a mapping), the read and discard
+// buffers, and an output buffer that only grows. Steady-state extraction through a workspace makes no
+// allocation and no open()/close(), so threads do not contend on the allocator. One thread at a time.
+typedef struct extract_workspace {
+    struct deflate_index *index;     // per-thread copy, owns strm
+    FILE *in;                        // the compressed file, or NULL when map is set
+    const gz_mapping_t *map;         // borrowed, must outlive the workspace
+    unsigned char input[CHUNK];      // fread() buffer
+    unsigned char discard[WINSIZE];  // bytes inflated between the access point and the offset
+    unsigned char *buf;              // see extract_workspace_buffer()
+    size_t capacity;
+} extract_workspace_t;
+
+// Workspace extracting gzFile with index, or from map instead when it is given and mapped. Returns NULL if
+// the file cannot be opened or memory runs out.
+extract_workspace_t *extract_workspace_open(struct deflate_index *index, const char *gzFile,
+                                            const gz_mapping_t *map = NULL) {
+    extract_workspace_t *ws = (extract_workspace_t *) malloc(sizeof(extract_workspace_t));
+    if (ws == NULL)
+        return NULL;
+    ws->map = map != NULL && map->data != NULL ? map : NULL;
+    ws->in = NULL;
+    if (ws->map == NULL && (ws->in = fopen(gzFile, "rb")) == NULL) {
+        free(ws);
+        return NULL;
+    }
+    ws->index = new struct deflate_index(*index);
+    ws->buf = NULL;
+    ws->capacity = 0;
+    return ws;
+}
+
+void extract_workspace_close(extract_workspace_t *ws) {
+    if (ws == NULL)
+        return;
+    if (ws->in != NULL)
+        fclose(ws->in);
+    inflateEnd(&ws->index->strm);
+    delete ws->index;
+    free(ws->buf);
+    free(ws);
+}
+
+// The workspace's own output buffer, grown to at least len bytes. Returns NULL if memory runs out.
+unsigned char *extract_workspace_buffer(extract_workspace_t *ws, size_t len) {
+    if (len > ws->capacity) {
+        unsigned char *grown = (unsigned char *) realloc(ws->buf, len);
+        if (grown == NULL)
+            return NULL;
+        ws->buf = grown;
+        ws->capacity = len;
+    }
+    return ws->buf;
+}
+
+// read_index() through a workspace. With buf NULL the records land in the workspace's own buffer, which is
+// overwritten by the next call; pass a buffer to keep them.
+std::pair<unsigned char *, int>
+read_index(extract_workspace_t *ws, off_t record_idx, off_t num_records, unsigned char *buf = NULL,
+           extract_stats_t *stats = NULL) {
+    struct deflate_index *index = ws->index;
+    off_t offset = (*index->record_boundaries)[record_idx];
+    off_t read_len = get_read_len(index, record_idx, num_records);
+    if (buf == NULL && (buf = extract_workspace_buffer(ws, read_len)) == NULL)
+        return std::make_pair(buf, (int) Z_MEM_ERROR);
+
+    ptrdiff_t got;
+    if (ws->map != NULL) {
+        gz_mapping_advise(ws->map, index, offset, read_len);
+        mem_source src(ws->map->data, ws->map->size);
+        got = deflate_index_extract_from(src, index, offset, buf, read_len, stats, ws->discard);
+    } else {
+        file_source src(ws->in, ws->input);
+        got = deflate_index_extract_from(src, index, offset, buf, read_len, stats, ws->discard);
+    }
+    return std::make_pair(buf, (int) got);
+}
+
 std::pair<unsigned char *, int>
 read_index(const char *gzFile1, const char *indexFile, off_t record_idx, off_t num_records) {
     struct deflate_index *index = NULL;
@@ -821,10 +1325,8 @@ read_index(const char *gzFile1, const char *indexFile, off_t record_idx, off_t n
         return std::make_pair<unsigned char *, int>(NULL, -1);
     }
 
-    gzFile index_file_gzip = gzopen(indexFile, "rb");
-
 //    len = deflate_index_load(index_file, &index);
-    len = deflate_index_load_gzip(index_file_gzip, &index);
+    len = deflate_index_load_lazy(indexFile, &index);
     fclose(index_file);
 
     if (len < 0) {
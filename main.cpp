@@ -3,6 +3,11 @@
 #include <chrono>
 #include "kseq++/seqio.hpp"
 #include "kseqcharstream.hpp"
+#include "repack.hpp"
+#include "recordserver.hpp"
+#include "sample.hpp"
+#include "parser.hpp"
+#include "validate.hpp"
 using namespace std;
 using namespace klibpp;
 
@@ -22,7 +27,13 @@ int main(int argc, char **argv) {
             fprintf(stderr, "zran: invalid record_idx\n");
             return 1;
         }
-        build_index(argv[2], span);
+        bool with_summaries = false;
+        bool plain = false;
+        for (int i = 4; i < argc; i++) {
+            with_summaries |= strcmp(argv[i], "stats") == 0;
+            plain |= strcmp(argv[i], "plain") == 0;
+        }
+        build_index(argv[2], span, with_summaries, NULL, plain);
         auto end = std::chrono::high_resolution_clock::now();
 
         // Calculate the duration in milliseconds
@@ -31,6 +42,250 @@ int main(int argc, char **argv) {
         // Output the duration
         std::cout << "Time taken to build index (total): " << duration2.count() << " milliseconds" << std::endl;
 
+    } else if (strcmp(argv[1], "repack") == 0) {
+        // repack mode: recompress into record-aligned independent gzip members with a window-free index
+        if (argc < 5) {
+            fprintf(stderr, "Usage: ./main.out repack <fastq_file> <index_file> <output_file> [block_bytes] [threads]\n");
+            return 1;
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        uint64_t block_bytes = argc > 5 ? strtoull(argv[5], NULL, 0) : ParallelGzWriter::DEFAULT_BLOCK_SIZE;
+        unsigned threads = argc > 6 ? atoi(argv[6]) : std::thread::hardware_concurrency();
+        struct deflate_index *index = NULL;
+        gzFile index_file_gzip = gzopen(argv[3], "rb");
+        if (index_file_gzip == NULL || deflate_index_load_gzip(index_file_gzip, &index) < 0) {
+            fprintf(stderr, "zran: could not load index %s\n", argv[3]);
+            return 1;
+        }
+        int ret = repack(argv[2], index, argv[4], block_bytes, threads);
+        deflate_index_free(index);
+        if (ret != 0)
+            return 1;
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        std::cout << "Time taken to repack (total): " << duration.count() << " milliseconds" << std::endl;
+    } else if (strcmp(argv[1], "sample") == 0) {
+        // sample mode: a seeded random subset of records, inflating only the spans that hold one
+        if (argc < 5) {
+            fprintf(stderr, "Usage: ./main.out sample <fastq_file> <index_file> <count|fraction> [seed] [threads] [output_file]\n");
+            return 1;
+        }
+        // A value with a decimal point, or below 1, is a fraction of the records
+        char *arg_end;
+        double amount = strtod(argv[4], &arg_end);
+        bool fraction = strchr(argv[4], '.') != NULL || amount < 1;
+        if (*arg_end || arg_end == argv[4] || !(amount > 0) || (fraction && amount > 1)) {
+            fprintf(stderr, "zran: invalid count or fraction\n");
+            return 1;
+        }
+        uint64_t seed = 42;
+        if (argc > 5) {
+            seed = strtoull(argv[5], &arg_end, 0);
+            if (*arg_end || arg_end == argv[5]) {
+                fprintf(stderr, "zran: invalid seed\n");
+                return 1;
+            }
+        }
+        unsigned threads = std::thread::hardware_concurrency();
+        if (argc > 6) {
+            long long value = strtoll(argv[6], &arg_end, 0);
+            if (*arg_end || arg_end == argv[6] || value <= 0) {
+                fprintf(stderr, "zran: invalid threads\n");
+                return 1;
+            }
+            threads = value;
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        struct deflate_index *index = NULL;
+        if (deflate_index_load_lazy(argv[3], &index) < 0) {
+            fprintf(stderr, "zran: could not load index %s\n", argv[3]);
+            return 1;
+        }
+        // Compared as doubles first, so a count beyond the file is never converted out of range
+        off_t count = fraction ? (off_t) (amount * index->num_records + 0.5)
+                               : amount >= index->num_records ? index->num_records : (off_t) amount;
+        FILE *out = argc > 7 ? fopen(argv[7], "wb") : stdout;
+        if (out == NULL) {
+            fprintf(stderr, "zran: could not open %s for writing\n", argv[7]);
+            deflate_index_free(index);
+            return 1;
+        }
+        std::vector<off_t> selected = sample_record_indices(index->num_records, count, seed);
+        int ret = sample_records(argv[2], index, selected, out, threads);
+        if (out != stdout)
+            fclose(out);
+        deflate_index_free(index);
+        if (ret != 0)
+            return 1;
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        std::cerr << "Time taken to sample (total): " << duration.count() << " milliseconds" << std::endl;
+    } else if (strcmp(argv[1], "validate") == 0) {
+        // validate mode: strict FASTQ check of every record, one chunk of records per claim on all cores
+        if (argc < 4) {
+            fprintf(stderr, "Usage: ./main.out validate <fastq_file> <index_file> [max_errors] [threads] [chunk_records]\n");
+            return 1;
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        size_t max_errors = argc > 4 ? strtoull(argv[4], NULL, 10) : 10;
+        unsigned threads = argc > 5 ? atoi(argv[5]) : std::thread::hardware_concurrency();
+        uint64_t chunk_records = argc > 6 ? strtoull(argv[6], NULL, 10) : 10000;
+        ParrFQParser parser;
+        if (parser.init(argv[2], argv[3], chunk_records, threads > 0 ? threads : 1) != 0)
+            return 1;
+        FastqValidation report;
+        report.maxErrors = max_errors;
+        int ret = parser.mapReduceChunks<FastqValidation>(
+            [&parser, max_errors](char *buf, size_t len, uint64_t first_record, FastqValidation &partial) {
+                partial.maxErrors = max_errors;
+                partial.checkChunk(buf, len, first_record, parser.recordBoundaries());
+            },
+            [](FastqValidation &total, const FastqValidation &partial) { total.merge(partial); }, report);
+        if (ret != 0)
+            return 1;
+        // The index builder stops at a record it cannot parse, and nothing past the index can be checked. The
+        // index's end sentinel overshoots the last record, so compare where that record really ends
+        const std::vector<uint64_t> &boundaries = parser.recordBoundaries();
+        bool truncated = report.end < parser.uncompressedLength();
+        for (const FastqError &error : report.errors)
+            printf("record %llu, offset %llu: %s\n", (unsigned long long) error.record,
+                   (unsigned long long) error.offset, error.message.c_str());
+        printf("%llu records, %llu bases, %llu invalid records\n", (unsigned long long) report.records,
+               (unsigned long long) report.bases, (unsigned long long) report.errorCount);
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        std::cerr << "Time taken to validate (total): " << duration.count() << " milliseconds" << std::endl;
+        if (truncated)
+            printf("the index ends with record %llu at offset %llu; the unindexed tail of %llu bytes was not checked\n",
+                   (unsigned long long) boundaries.size() - 2, (unsigned long long) report.end,
+                   (unsigned long long) (parser.uncompressedLength() - report.end));
+        if (report.errorCount != 0 || truncated)
+            return 2;
+    } else if (strcmp(argv[1], "summary") == 0) {
+        // summary mode: aggregates answered from the index alone
+        if (argc < 3) {
+            fprintf(stderr, "Usage: ./main.out summary <index_file> [first last]\n");
+            return 1;
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        struct deflate_index *index = NULL;
+        gzFile index_file_gzip = gzopen(argv[2], "rb");
+        // deflate_index_load_gzip() closes the file only when it succeeds
+        if (index_file_gzip == NULL || deflate_index_load_gzip(index_file_gzip, &index) < 0) {
+            fprintf(stderr, "zran: could not load index %s\n", argv[2]);
+            if (index_file_gzip != NULL)
+                gzclose(index_file_gzip);
+            return 1;
+        }
+        long long first = 0;
+        long long last = index->have;
+        if (argc > 3) {
+            char *end;
+            first = strtoll(argv[3], &end, 0);
+            if (*end || end == argv[3]) {
+                fprintf(stderr, "zran: invalid first access point\n");
+                deflate_index_free(index);
+                return 1;
+            }
+        }
+        if (argc > 4) {
+            char *end;
+            last = strtoll(argv[4], &end, 0);
+            if (*end || end == argv[4]) {
+                fprintf(stderr, "zran: invalid last access point\n");
+                deflate_index_free(index);
+                return 1;
+            }
+        }
+        if (first < 0 || first > last || last > index->have) {
+            fprintf(stderr, "zran: access points [%lld, %lld) are not within [0, %d]\n", first, last, index->have);
+            deflate_index_free(index);
+            return 1;
+        }
+        span_summary_t total = {};
+        if (deflate_index_summarize(index, first, last, &total) != Z_OK) {
+            fprintf(stderr, "zran: index has no summaries for access points [%lld, %lld), rebuild it with 'build <file> <span> stats'\n",
+                    first, last);
+            deflate_index_free(index);
+            return 1;
+        }
+        uint64_t acgt = total.bases[0] + total.bases[1] + total.bases[2] + total.bases[3];
+        cout << "access points: [" << first << ", " << last << ") of " << index->have << endl;
+        cout << "records: " << total.records << endl;
+        cout << "#A: " << total.bases[0] << endl;
+        cout << "#C: " << total.bases[1] << endl;
+        cout << "#G: " << total.bases[2] << endl;
+        cout << "#T: " << total.bases[3] << endl;
+        cout << "#N: " << total.bases[4] << endl;
+        cout << "GC: " << (acgt ? (double) (total.bases[1] + total.bases[2]) / acgt : 0.0) << endl;
+        cout << "mean quality: " << (total.qual_bases ? (double) total.qual_sum / total.qual_bases : 0.0) << endl;
+        cout << "read length histogram:" << endl;
+        for (int b = 0; b < LEN_BINS; b++) {
+            // Bin 0 also holds empty reads
+            if (total.length_hist[b])
+                cout << "  [" << (b == 0 ? 0 : 1ULL << b) << ", " << (1ULL << (b + 1)) << "): " << total.length_hist[b] << endl;
+        }
+        cout << "quality histogram:" << endl;
+        for (int b = 0; b < QUAL_BINS; b++) {
+            if (total.qual_hist[b])
+                cout << "  Q" << b << ": " << total.qual_hist[b] << endl;
+        }
+        deflate_index_free(index);
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        std::cout << "Time taken (total): " << duration.count() << " milliseconds" << std::endl;
+    } else if (strcmp(argv[1], "serve") == 0) {
+        // serve mode: keep indexes and decompressed blocks resident and answer queries on a Unix socket
+        if (argc < 3) {
+            fprintf(stderr, "Usage: ./main.out serve <socket_path> [cache_mb] [block_records]\n");
+            return 1;
+        }
+        size_t cache_mb = argc > 3 ? strtoull(argv[3], NULL, 0) : 256;
+        long long block_records = 4096;
+        if (argc > 4) {
+            char *end;
+            block_records = strtoll(argv[4], &end, 0);
+            if (*end || end == argv[4] || block_records <= 0) {
+                fprintf(stderr, "zran: invalid block_records\n");
+                return 1;
+            }
+        }
+        RecordServer server(cache_mb << 20, block_records);
+        return server.serve(argv[2]) == 0 ? 0 : 1;
+    } else if (strcmp(argv[1], "query") == 0) {
+        // query mode: thin client of serve mode, same output as use mode
+        bool stop = argc == 4 && strcmp(argv[3], "stop") == 0;
+        if (argc < 7 && !stop) {
+            fprintf(stderr, "Usage: ./main.out query <socket_path> <fastq_file> <index_file> records <record_idx> <num_records>\n"
+                            "       ./main.out query <socket_path> <fastq_file> <index_file> name <read_name>\n"
+                            "       ./main.out query <socket_path> <fastq_file> <index_file> bytes <offset> <length>\n"
+                            "       ./main.out query <socket_path> stop\n");
+            return 1;
+        }
+        RecordClient client;
+        if (!client.connect(argv[2])) {
+            fprintf(stderr, "zran: could not connect to %s\n", argv[2]);
+            return 1;
+        }
+        std::string payload;
+        int status;
+        if (stop) {
+            status = client.request(SERVER_STOP, "", "", 0, 0, "", payload);
+        } else if (strcmp(argv[5], "name") == 0) {
+            status = client.request(RECORD_BY_NAME, argv[3], argv[4], 0, 0, argv[6], payload);
+        } else if (argc > 7 && (strcmp(argv[5], "records") == 0 || strcmp(argv[5], "bytes") == 0)) {
+            RecordRequestType type = strcmp(argv[5], "records") == 0 ? RECORD_RANGE : BYTE_RANGE;
+            status = client.request(type, argv[3], argv[4], strtoull(argv[6], NULL, 0), strtoull(argv[7], NULL, 0), "",
+                                    payload);
+        } else {
+            fprintf(stderr, "zran: unknown query %s\n", argv[5]);
+            return 1;
+        }
+        if (status != 0) {
+            fprintf(stderr, "zran: query failed: %s\n", status == -2 ? "connection lost" : payload.c_str());
+            return 1;
+        }
+        fwrite(payload.data(), 1, payload.size(), stdout);
     } else {
         // use mode
         off_t record_idx = -1;
@@ -1,6 +1,7 @@
 #include "utils/io.hpp"
 #include <chrono>
 #include <kseq++/seqio.hpp>
+#include "seqkernels.hpp"
 using namespace std;
 using namespace klibpp;
 
@@ -15,28 +16,16 @@ int main(int argc, char* argv[]) {
     }
     auto end_read = std::chrono::high_resolution_clock::now();
     cout << "Number of records: " << ids.size() << endl;
-    long long int countA = 0;
-    long long int countC = 0;
-    long long int countG = 0;
-    long long int countT = 0;
-
+    BaseCounts counts;
     for(auto &s: genomes) {
-        for(auto &ch: s) {
-            if (ch == 'A') {
-                countA++;
-            } else if (ch == 'C') {
-                countC++;
-            } else if (ch == 'G') {
-                countG++;
-            } else if (ch == 'T') {
-                countT++;
-            }
-        }
+        count_bases(s.data(), s.size(), counts);
     }
-    cout <<"#A: " << countA << endl;
-    cout <<"#C: " << countC << endl;
-    cout <<"#G: " << countG << endl;
-    cout <<"#T: " << countT << endl;
+    cout <<"#A: " << counts.A << endl;
+    cout <<"#C: " << counts.C << endl;
+    cout <<"#G: " << counts.G << endl;
+    cout <<"#T: " << counts.T << endl;
+    cout <<"#N: " << counts.N << endl;
+    cout <<"GC: " << counts.gcContent() << endl;
     auto end = std::chrono::high_resolution_clock::now();
 
     // Calculate the duration in milliseconds
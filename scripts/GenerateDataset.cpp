@@ -0,0 +1,335 @@
+#include <zlib.h>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include "pgzwriter.hpp"
+using namespace std;
+
+// Deterministic generator for synthetic .fq.gz/.fa.gz files, so the benchmarks can run without
+// downloading the datasets listed in the README. The same seed and options always produce the same
+// bytes, whatever the thread count.
+
+struct GenOptions {
+  string out;
+  uint64_t size = 100ULL << 20;  // uncompressed bytes to generate
+  bool fastq = true;
+  string lengths = "fixed:150";
+  string quality = "illumina";
+  string header = "sra";
+  size_t lineWidth = 0;  // FASTA line width, 0 keeps every sequence on one line
+  double gc = 0.5;
+  double nRate = 0.0005;   // probability of a single N at each base
+  double nRunsPerMb = 0;   // FASTA: assembly gaps (runs of 100-10000 N) per Mbp
+  uint64_t memberBytes = 0;  // 0 writes a single gzip member
+  int level = Z_DEFAULT_COMPRESSION;
+  unsigned threads = 0;
+  uint64_t seed = 42;
+};
+
+// Shapes of the published benchmark datasets
+bool applyPreset(const string& name, GenOptions& opt) {
+  if (name == "illumina") {  // Ecoli/Nematode SRA runs: short reads with binned qualities
+    opt.fastq = true;
+    opt.lengths = "fixed:150";
+    opt.quality = "illumina";
+    opt.header = "sra";
+  } else if (name == "longread") {  // Nanopore-style reads, long tail of lengths, low qualities
+    opt.fastq = true;
+    opt.lengths = "lognormal:5000,0.8";
+    opt.quality = "uniform:5,25";
+    opt.header = "nanopore";
+  } else if (name == "contigs") {  // seqkit dataset_A: tens of thousands of wrapped FASTA records
+    opt.fastq = false;
+    opt.lengths = "lognormal:8000,0.9";
+    opt.header = "contig";
+    opt.lineWidth = 60;
+  } else if (name == "chromosome") {  // seqkit dataset_B / Salmonella: a few very long sequences
+    opt.fastq = false;
+    opt.lengths = "lognormal:2000000,1.0";
+    opt.header = "chromosome";
+    opt.lineWidth = 60;
+    opt.nRate = 0;
+    opt.nRunsPerMb = 2;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+uint64_t parseSize(const string& s) {
+  size_t pos;
+  double v = stod(s, &pos);
+  if (pos < s.size()) {
+    switch (toupper(s[pos])) {
+      case 'K': v *= 1ULL << 10; break;
+      case 'M': v *= 1ULL << 20; break;
+      case 'G': v *= 1ULL << 30; break;
+    }
+  }
+  return static_cast<uint64_t>(v);
+}
+
+// "kind:a,b" -> kind, a, b
+void parseModel(const string& spec, string& kind, double& a, double& b) {
+  size_t colon = spec.find(':');
+  kind = spec.substr(0, colon);
+  a = b = 0;
+  if (colon == string::npos) return;
+  string args = spec.substr(colon + 1);
+  size_t comma = args.find(',');
+  a = stod(args.substr(0, comma));
+  if (comma != string::npos) b = stod(args.substr(comma + 1));
+}
+
+class Generator {
+ public:
+  explicit Generator(const GenOptions& opt) : m_opt(opt), m_rng(opt.seed) {
+    parseModel(opt.lengths, m_lenKind, m_lenA, m_lenB);
+    parseModel(opt.quality, m_qualKind, m_qualA, m_qualB);
+    // 16-bit thresholds: N, then G/C, then A/T
+    m_nThreshold = static_cast<uint32_t>(opt.nRate * 65536);
+    m_gcThreshold = m_nThreshold + static_cast<uint32_t>(opt.gc * (65536 - m_nThreshold));
+  }
+
+  bool validModels() const {
+    bool lenOk = m_lenKind == "fixed" || m_lenKind == "uniform" || m_lenKind == "normal" || m_lenKind == "lognormal";
+    bool qualOk = m_qualKind == "illumina" || m_qualKind == "decay" || m_qualKind == "uniform";
+    return lenOk && qualOk && m_lenA > 0;
+  }
+
+  // Appends the next record to out
+  void record(uint64_t id, string& out) {
+    size_t len = readLength();
+    header(id, len, out);
+    size_t seqStart = out.size();
+    sequence(len, out);
+    if (m_opt.fastq) {
+      out += "\n+\n";
+      qualities(len, out);
+      out += '\n';
+    } else {
+      wrap(seqStart, out);
+    }
+  }
+
+ private:
+  const GenOptions& m_opt;
+  std::mt19937_64 m_rng;
+  string m_lenKind, m_qualKind;
+  double m_lenA, m_lenB, m_qualA, m_qualB;
+  uint32_t m_nThreshold, m_gcThreshold;
+
+  size_t readLength() {
+    double len = m_lenA;
+    if (m_lenKind == "uniform") {
+      len = std::uniform_real_distribution<double>(m_lenA, m_lenB)(m_rng);
+    } else if (m_lenKind == "normal") {
+      len = std::normal_distribution<double>(m_lenA, m_lenB)(m_rng);
+    } else if (m_lenKind == "lognormal") {  // a is the median
+      len = std::lognormal_distribution<double>(std::log(m_lenA), m_lenB)(m_rng);
+    }
+    return len < 1 ? 1 : static_cast<size_t>(len);
+  }
+
+  void header(uint64_t id, size_t len, string& out) {
+    ostringstream os;
+    os << (m_opt.fastq ? '@' : '>');
+    const string& style = m_opt.header;
+    if (style == "sra") {
+      os << "SRR" << 28500000 + m_opt.seed % 100000 << '.' << id << ' ' << id << " length=" << len;
+    } else if (style == "illumina") {
+      uint64_t tile = 1101 + (id / 400000) % 100;
+      os << "A00123:8:H2C3LDSXX:" << 1 + id % 4 << ':' << tile << ':' << 1000 + m_rng() % 30000 << ':'
+         << 1000 + m_rng() % 30000 << " 1:N:0:ACGTACGT+TGCATGCA";
+    } else if (style == "nanopore") {
+      uint64_t a = m_rng(), b = m_rng();
+      char uuid[40];
+      snprintf(uuid, sizeof(uuid), "%08x-%04x-%04x-%04x-%012llx", (unsigned) (a >> 32), (unsigned) (a >> 16) & 0xffff,
+               (unsigned) a & 0xffff, (unsigned) (b >> 48), (unsigned long long) (b & 0xffffffffffffULL));
+      os << uuid << " runid=" << std::hex << m_opt.seed << std::dec << " read=" << id << " ch=" << 1 + id % 512;
+    } else if (style == "contig") {
+      os << "contig_" << id << " len=" << len;
+    } else if (style == "chromosome") {
+      os << "chr" << id << " synthetic chromosome " << id;
+    } else {
+      os << "read" << id;
+    }
+    out += os.str();
+    out += '\n';
+  }
+
+  void sequence(size_t len, string& out) {
+    static const char GC[2] = {'G', 'C'};
+    static const char AT[2] = {'A', 'T'};
+    size_t start = out.size();
+    out.resize(start + len);
+    char* seq = &out[start];
+    for (size_t i = 0; i < len;) {
+      uint64_t r = m_rng();
+      for (int k = 0; k < 4 && i < len; ++k, ++i, r >>= 16) {
+        uint32_t v = r & 0xffff;
+        seq[i] = v < m_nThreshold ? 'N' : v < m_gcThreshold ? GC[v & 1] : AT[v & 1];
+      }
+    }
+    if (m_opt.nRunsPerMb > 0) {
+      std::poisson_distribution<int> runs(m_opt.nRunsPerMb * len / 1e6);
+      for (int n = runs(m_rng); n > 0; --n) {
+        size_t runLen = 100 + m_rng() % 9901;
+        size_t pos = m_rng() % len;
+        std::fill(seq + pos, seq + std::min(len, pos + runLen), 'N');
+      }
+    }
+  }
+
+  void qualities(size_t len, string& out) {
+    size_t start = out.size();
+    out.resize(start + len);
+    char* qual = &out[start];
+    if (m_qualKind == "illumina") {
+      // NovaSeq-style 4-bin qualities, mostly Q37, worse towards the 3' end
+      static const char BINS[4] = {'#', '-', '8', 'F'};
+      for (size_t i = 0; i < len; ++i) {
+        uint32_t v = m_rng() & 0xff;
+        uint32_t bad = 4 + 24 * i / len;
+        qual[i] = v < bad / 4 ? BINS[0] : v < bad / 2 ? BINS[1] : v < bad ? BINS[2] : BINS[3];
+      }
+    } else if (m_qualKind == "decay") {
+      // Mean quality falls linearly from a to b along the read
+      std::normal_distribution<double> noise(0, 3);
+      for (size_t i = 0; i < len; ++i) {
+        double q = m_qualA + (m_qualB - m_qualA) * i / len + noise(m_rng);
+        qual[i] = 33 + static_cast<char>(std::max(2.0, std::min(41.0, q)));
+      }
+    } else {
+      uint32_t span = static_cast<uint32_t>(m_qualB - m_qualA) + 1;
+      for (size_t i = 0; i < len; ++i) {
+        qual[i] = 33 + static_cast<char>(m_qualA + m_rng() % span);
+      }
+    }
+  }
+
+  // Breaks the sequence starting at seqStart into lines of lineWidth bases
+  void wrap(size_t seqStart, string& out) {
+    size_t width = m_opt.lineWidth;
+    size_t len = out.size() - seqStart;
+    if (width == 0 || len <= width) {
+      out += '\n';
+      return;
+    }
+    string seq = out.substr(seqStart);
+    out.resize(seqStart);
+    for (size_t i = 0; i < len; i += width) {
+      out.append(seq, i, width);
+      out += '\n';
+    }
+  }
+};
+
+void usage() {
+  cerr << "Usage: ./generate_data.out <output.fq.gz|output.fa.gz> [options]\n"
+       << "  --preset illumina|longread|contigs|chromosome   shape of a published dataset (default illumina)\n"
+       << "  --size 100M                 uncompressed bytes to generate (K/M/G suffixes)\n"
+       << "  --format fastq|fasta\n"
+       << "  --lengths fixed:L | uniform:min,max | normal:mean,sd | lognormal:median,sigma\n"
+       << "  --quality illumina | decay:from,to | uniform:min,max   (Phred scores)\n"
+       << "  --header sra|illumina|nanopore|contig|chromosome|plain\n"
+       << "  --line-width 60             FASTA line width, 0 for single-line records\n"
+       << "  --gc 0.5 --n-rate 0.0005    base composition\n"
+       << "  --n-runs 2                  FASTA gaps (runs of N) per Mbp\n"
+       << "  --members 1M                uncompressed bytes per gzip member, 0 for a single member\n"
+       << "  --level 6                   compression level\n"
+       << "  --threads 0                 compression threads for multi-member output\n"
+       << "  --seed 42\n";
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  GenOptions opt;
+  opt.out = argv[1];
+  // The preset goes first, so the other options can refine it
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (string(argv[i]) == "--preset" && !applyPreset(argv[i + 1], opt)) {
+      cerr << "Unknown preset " << argv[i + 1] << "\n";
+      return 1;
+    }
+  }
+  for (int i = 2; i + 1 < argc; i += 2) {
+    string flag = argv[i], value = argv[i + 1];
+    if (flag == "--preset") continue;
+    else if (flag == "--size") opt.size = parseSize(value);
+    else if (flag == "--format") opt.fastq = value != "fasta";
+    else if (flag == "--lengths") opt.lengths = value;
+    else if (flag == "--quality") opt.quality = value;
+    else if (flag == "--header") opt.header = value;
+    else if (flag == "--line-width") opt.lineWidth = stoull(value);
+    else if (flag == "--gc") opt.gc = stod(value);
+    else if (flag == "--n-rate") opt.nRate = stod(value);
+    else if (flag == "--n-runs") opt.nRunsPerMb = stod(value);
+    else if (flag == "--members") opt.memberBytes = parseSize(value);
+    else if (flag == "--level") opt.level = stoi(value);
+    else if (flag == "--threads") opt.threads = stoul(value);
+    else if (flag == "--seed") opt.seed = stoull(value);
+    else {
+      usage();
+      return 1;
+    }
+  }
+
+  Generator gen(opt);
+  if (!gen.validModels()) {
+    cerr << "Invalid --lengths or --quality model\n";
+    return 1;
+  }
+
+  gzFile single = NULL;
+  ParallelGzWriter* multi = NULL;
+  if (opt.memberBytes > 0) {
+    multi = new ParallelGzWriter(opt.out.c_str(), opt.threads, opt.memberBytes, opt.level);
+    if (multi->failed()) {
+      cerr << "Could not open " << opt.out << "\n";
+      return 1;
+    }
+  } else {
+    string mode = opt.level >= 0 ? "wb" + to_string(opt.level) : "wb";
+    single = gzopen(opt.out.c_str(), mode.c_str());
+    if (single == NULL) {
+      cerr << "Could not open " << opt.out << "\n";
+      return 1;
+    }
+    gzbuffer(single, 1 << 20);
+  }
+
+  string buf;
+  uint64_t written = 0, records = 0;
+  bool ok = true;
+  while (written < opt.size && ok) {
+    buf.clear();
+    while (buf.size() < (1 << 20) && written + buf.size() < opt.size) {
+      gen.record(++records, buf);
+    }
+    if (multi != NULL) {
+      ok = multi->write(buf.data(), buf.size()) == static_cast<int>(buf.size());
+    } else {
+      ok = gzwrite(single, buf.data(), buf.size()) == static_cast<int>(buf.size());
+    }
+    written += buf.size();
+  }
+  if (multi != NULL) {
+    ok = multi->close() == 0 && ok;
+    delete multi;
+  } else {
+    ok = gzclose(single) == Z_OK && ok;
+  }
+  if (!ok) {
+    cerr << "Writing " << opt.out << " failed\n";
+    return 1;
+  }
+  cout << "Wrote " << records << " records, " << written << " bytes uncompressed to " << opt.out << endl;
+  return 0;
+}
@@ -1,63 +1,179 @@
 #include "parser.hpp"
+#include "seqkernels.hpp"
 #include <iostream>
 #include <thread>
 #include <vector>
 #include <chrono>
 using namespace std;
 
-struct Bases {
-  uint32_t A, C, G, T;
-};
-
 int main(int argc, char* argv[]) {
   if (argc < 5) {
     std::cerr << "Command line arguments not provided\n";
-    std::cerr << "Usage ./test_parser <fastq_file> <index_file> <num_consumer_threads> <num_producer_threads>\n";
+    std::cerr << "Usage ./test_parser <fastq_file> <index_file> <num_consumer_threads> <num_producer_threads> [records|packed|chunks|batches|reduce][,mmap][,noprefetch][,names][,minlen=N][,minqual=Q][,maxn=F][,pipeline[=I:P]] [chunk_size] [trace.json]\n";
+    return 1;
   }
   std::string fastqFile = argv[1];
   std::string indexFile = argv[2];
   size_t nt = stoi(argv[3]);  // number of consumer threads
   size_t np = stoi(argv[4]);  // number of producer threads
+  // The mode can carry comma-separated input options, e.g. "reduce,mmap"
+  std::string mode = argc > 5 ? argv[5] : "";
+  bool mmapInput = mode.find(",mmap") != std::string::npos;
+  bool prefetch = mode.find(",noprefetch") == std::string::npos;
+  bool namesOnly = mode.find(",names") != std::string::npos;  // header scan: sequences are skipped, bases count as 0
+  // Producer-side filters, e.g. ",minlen=50,maxn=0.1"; the value follows the '='
+  auto option = [&mode](const std::string& key) -> std::string {
+    size_t at = mode.find("," + key + "=");
+    if (at == std::string::npos) return "";
+    at += key.size() + 2;
+    return mode.substr(at, mode.find(',', at) - at);
+  };
+  std::string minLen = option("minlen"), minQual = option("minqual"), maxN = option("maxn");
+  // Separate inflater and parser threads: ",pipeline" sizes the stages itself, ",pipeline=2:3" fixes them
+  bool pipeline = mode.find(",pipeline") != std::string::npos;
+  std::string stages = option("pipeline");
+  uint64_t inflaters = stages.empty() ? 0 : stoull(stages);
+  uint64_t parsers = stages.find(':') == std::string::npos ? 0 : stoull(stages.substr(stages.find(':') + 1));
+  mode = mode.substr(0, mode.find(','));
+  bool packed = mode == "packed";
+  bool chunks = mode == "chunks";
+  bool batches = mode == "batches";
+  uint64_t chunkSize = argc > 6 ? stoull(argv[6]) : 10000;  // records claimed by a producer at a time
+  std::string traceFile = argc > 7 ? argv[7] : "";  // Chrome trace-event JSON of the run
 
   ParrFQParser parser;
-  parser.init(fastqFile, indexFile, 10000, np);
+  parser.init(fastqFile, indexFile, chunkSize, np);
+  parser.setPackedOutput(packed);
+  parser.setChunkOutput(chunks);
+  parser.setBatchOutput(batches);
+  if (namesOnly) parser.setFields(klibpp::field::name);
+  parser.setMmapInput(mmapInput);
+  parser.setPrefetch(prefetch);
+  parser.setPipeline(pipeline, inflaters, parsers);
+  if (!minLen.empty()) parser.addFilter("minlen", recordfilter::minLength(stoull(minLen)));
+  if (!minQual.empty()) parser.addFilter("minqual", recordfilter::minMeanQuality(stod(minQual)));
+  if (!maxN.empty()) parser.addFilter("maxn", recordfilter::maxNFraction(stod(maxN)));
+  if (!traceFile.empty()) parser.enableTracing();
 
   auto start = std::chrono::high_resolution_clock::now();
+  if (mode == "reduce") {
+    // No consumers: the producers count bases straight from the extracted chunks
+    struct Partial {
+      BaseCounts bases;
+      size_t records = 0;
+    };
+    Partial total;
+    int ret = parser.mapReduceRecords<Partial>(
+        [](const RecordView& rec, Partial& p) {
+          ++p.records;
+          count_bases(rec.seq.data(), rec.seq.size(), p.bases);
+        },
+        [](Partial& acc, const Partial& p) {
+          acc.bases += p.bases;
+          acc.records += p.records;
+        },
+        total);
+    if (ret != 0) return 1;
+    std::cerr << "Parsed " << total.records << " total read pairs.\n";
+    std::cerr << "\n#A = " << total.bases.A << '\n';
+    std::cerr << "#C = " << total.bases.C << '\n';
+    std::cerr << "#G = " << total.bases.G << '\n';
+    std::cerr << "#T = " << total.bases.T << '\n';
+    std::cerr << "#N = " << total.bases.N << '\n';
+    std::cerr << "GC = " << total.bases.gcContent() << '\n';
+    std::cerr << '\n';
+    parser.stats().print(std::cerr);
+    if (!traceFile.empty() && parser.writeTrace(traceFile) != 0) std::cerr << "Could not write " << traceFile << '\n';
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start);
+    std::cout << "Time taken (total): " << duration.count() << " milliseconds" << std::endl;
+    return 0;
+  }
   cout << "Starting parsing" << endl;
-  parser.start();
+  if (parser.start() != 0) {
+    return 1;
+  }
 
   cout << "Parsers Started" << endl;
+  if (pipeline) cout << "Pipeline: " << parser.inflaterThreads() << " inflaters, " << parser.parserThreads() << " parsers" << endl;
 
   std::vector<std::thread> readers;
-  std::vector<Bases> counters(nt, {0, 0, 0, 0});
+  std::vector<BaseCounts> counters(nt);
   std::atomic<size_t> ctr{0};
   for (size_t i = 0; i < nt; ++i) {
+    if (packed) {
+      readers.emplace_back([&, i]() {
+        auto consumer = parser.getConsumer();
+        PackedSeq seq;
+        uint64_t counts[4] = {0, 0, 0, 0};
+        size_t records{0};
+        while (true) {
+          if (consumer.getPackedRead(seq)) {
+            ++records;
+            packed_base_counts(seq, counts);
+            for (const NRun& run : seq.exceptions) {
+              if (run.base == 'N' || run.base == 'n') counters[i].N += run.len;
+            }
+          } else if (consumer.finished()) {
+            break;
+          }
+        }
+        counters[i].A = counts[0];
+        counters[i].C = counts[1];
+        counters[i].G = counts[2];
+        counters[i].T = counts[3];
+        ctr += records;
+      });
+      continue;
+    }
+    if (chunks) {
+      readers.emplace_back([&, i]() {
+        auto consumer = parser.getConsumer();
+        RecordChunkPtr chunk;
+        size_t records{0};
+        while (true) {
+          if (consumer.getChunk(chunk)) {
+            for (const RecordView& rec : chunk->records) {
+              count_bases(rec.seq.data(), rec.seq.size(), counters[i]);
+            }
+            records += chunk->records.size();
+            chunk.reset();
+          } else if (consumer.finished()) {
+            break;
+          }
+        }
+        ctr += records;
+      });
+      continue;
+    }
+    if (batches) {
+      readers.emplace_back([&, i]() {
+        auto consumer = parser.getConsumer();
+        RecordBatchPtr batch;
+        size_t records{0};
+        while (true) {
+          if (consumer.getBatch(batch)) {
+            // One kernel call over all sequences of the batch
+            count_bases(batch->seqs.data(), batch->seqs.size(), counters[i]);
+            records += batch->size();
+            batch.reset();
+          } else if (consumer.finished()) {
+            break;
+          }
+        }
+        ctr += records;
+      });
+      continue;
+    }
     readers.emplace_back([&, i]() {
-      auto rg = parser.getConsumerToken();
+      auto consumer = parser.getConsumer();
       size_t lctr{0};
       size_t pctr{0};
       klibpp::KSeq seq;
+      BaseCounts local;
       while (true) {
-        if (parser.getRead(rg, seq)) {
-            for (size_t j = 0; j < seq.seq.length(); ++j) {
-              char c = seq.seq[j];
-              switch (c) {
-              case 'A':
-                counters[i].A++;
-                break;
-              case 'C':
-                counters[i].C++;
-                break;
-              case 'G':
-                counters[i].G++;
-                break;
-              case 'T':
-                counters[i].T++;
-                break;
-              default:
-                break;
-              }
-            }
+        if (consumer.getRead(seq)) {
+          ++lctr;
+          count_bases(seq.seq.data(), seq.seq.size(), local);
           ctr += (lctr - pctr);
           pctr = lctr;
           if (lctr > 1000000) {
@@ -65,10 +181,12 @@ int main(int argc, char* argv[]) {
               pctr = 0;
               //std::cout << "parsed " << ctr << " read pairs.\n";
           }
-        } else if (parser.checkFinished()) {
+        } else if (consumer.finished()) {
           break;
         }
       }
+      ctr += (lctr - pctr);
+      counters[i] = local;
     });
   }
 
@@ -78,12 +196,9 @@ int main(int argc, char* argv[]) {
 
   parser.stop();
 
-  Bases b = {0, 0, 0, 0};
+  BaseCounts b;
   for (size_t i = 0; i < nt; ++i) {
-    b.A += counters[i].A;
-    b.C += counters[i].C;
-    b.G += counters[i].G;
-    b.T += counters[i].T;
+    b += counters[i];
   }
   std::cerr << "\n";
   std::cerr << "Parsed " << ctr << " total read pairs.\n";
@@ -91,6 +206,11 @@ int main(int argc, char* argv[]) {
   std::cerr << "#C = " << b.C << '\n';
   std::cerr << "#G = " << b.G << '\n';
   std::cerr << "#T = " << b.T << '\n';
+  std::cerr << "#N = " << b.N << '\n';
+  std::cerr << "GC = " << b.gcContent() << '\n';
+  std::cerr << '\n';
+  parser.stats().print(std::cerr);
+  if (!traceFile.empty() && parser.writeTrace(traceFile) != 0) std::cerr << "Could not write " << traceFile << '\n';
   auto end = std::chrono::high_resolution_clock::now();
 
   // Calculate the duration in milliseconds
@@ -0,0 +1,92 @@
+#include "parsercoro.hpp"
+#include "seqkernels.hpp"
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <chrono>
+using namespace std;
+
+// Same base count as test_parser, with consumers written as coroutines:
+//   generator - one thread per consumer, each a range-for over readBatches()
+//   await     - all consumers are coroutines on the main thread, suspended while the queue is empty
+
+DetachedTask consume(AsyncConsumer& consumer, BaseCounts& counts, size_t& records, size_t& done) {
+  ReadBatch batch;
+  while (co_await consumer.next(batch)) {
+    for (auto& rec : batch) {
+      count_bases(rec.seq.data(), rec.seq.size(), counts);
+    }
+    records += batch.size();
+  }
+  ++done;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 5) {
+    std::cerr << "Command line arguments not provided\n";
+    std::cerr << "Usage ./test_parser_coro <fastq_file> <index_file> <num_consumers> <num_producer_threads> [generator|await] [batch_size]\n";
+    return 1;
+  }
+  std::string fastqFile = argv[1];
+  std::string indexFile = argv[2];
+  size_t nt = stoi(argv[3]);  // number of consumers
+  size_t np = stoi(argv[4]);  // number of producer threads
+  std::string mode = argc > 5 ? argv[5] : "generator";
+  size_t batchSize = argc > 6 ? stoull(argv[6]) : 1024;
+
+  ParrFQParser parser;
+  parser.init(fastqFile, indexFile, 10000, np);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  if (parser.start() != 0) {
+    return 1;
+  }
+
+  std::vector<BaseCounts> counters(nt);
+  std::vector<size_t> records(nt, 0);
+  if (mode == "await") {
+    ManualExecutor executor;
+    std::vector<std::unique_ptr<AsyncConsumer>> consumers;
+    size_t done = 0;
+    for (size_t i = 0; i < nt; ++i) {
+      consumers.emplace_back(new AsyncConsumer(parser, executor.executor(), batchSize));
+      consume(*consumers[i], counters[i], records[i], done);
+    }
+    executor.runUntil([&]() { return done == nt; });
+  } else {
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < nt; ++i) {
+      readers.emplace_back([&, i]() {
+        for (ReadBatch& batch : readBatches(parser, batchSize)) {
+          for (auto& rec : batch) {
+            count_bases(rec.seq.data(), rec.seq.size(), counters[i]);
+          }
+          records[i] += batch.size();
+        }
+      });
+    }
+    for (auto& t : readers) {
+      t.join();
+    }
+  }
+  parser.stop();
+
+  BaseCounts b;
+  size_t ctr = 0;
+  for (size_t i = 0; i < nt; ++i) {
+    b += counters[i];
+    ctr += records[i];
+  }
+  std::cerr << "Parsed " << ctr << " total read pairs.\n";
+  std::cerr << "\n#A = " << b.A << '\n';
+  std::cerr << "#C = " << b.C << '\n';
+  std::cerr << "#G = " << b.G << '\n';
+  std::cerr << "#T = " << b.T << '\n';
+  std::cerr << "#N = " << b.N << '\n';
+  std::cerr << "GC = " << b.gcContent() << '\n';
+  std::cerr << '\n';
+  parser.stats().print(std::cerr);
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start);
+  std::cout << "Time taken (total): " << duration.count() << " milliseconds" << std::endl;
+  return 0;
+}